@@ -1,4 +1,4 @@
-#include <Arduino.h>
+#include "hal.h"
 #include "artnet.h"
 #include "controller.h"
 #include "debugprint.h"
@@ -26,6 +26,9 @@ static const PROGMEM char* OpcodeToStr(uint16_t opcode)
     case OpNzs:
       return PSTR("OpNzs");
 
+    case OpSync:
+      return PSTR("OpSync");
+
     case OpAddress:
       return PSTR("OpAddress");
 
@@ -139,35 +142,149 @@ static const PROGMEM char* PriorityCodeToStr(uint8_t prioritycode)
 static const char g_artnetstr[] = "Art-Net";
 static const uint8_t g_broadcastaddress[] = {255, 255, 255, 255};
 
+//the counters in NodeReport are clamped to 16 bits, so the longest report still fits in its 64 bytes
+static uint16_t Clamp16(uint32_t value)
+{
+  return value < 0xFFFF ? value : 0xFFFF;
+}
+
 CArtNet::CArtNet(CController& controller, uint8_t* buf, uint8_t* ip, uint8_t* mac) :
   m_controller(controller), m_transmitbuf(buf), m_ip(ip), m_mac(mac)
 {
   m_portaddress = 0;
   m_sendpollreply = false;
   m_sendpollreplytime = 0;
-  m_sendpollreplydelay = 0;
+  m_sendunicastreply = false;
+  m_sendunicastreplytime = 0;
+  memset(m_unicastreplyip, 0, sizeof(m_unicastreplyip));
+  m_random = 1;
+  m_senddiag = false;
+  memset(m_diagip, 0, sizeof(m_diagip));
+  memset(m_sources, 0, sizeof(m_sources));
+  m_merging = false;
+  m_mergeltp = false;
+  m_cancelmerge = false;
+  m_filter = FilterOff;
+  m_dmxtime = 0;
+  m_broadcastdmxtime = 0;
+  m_dhcppending = false;
+  m_pollreplycount = 0;
+  m_packetslost = 0;
+  m_packetsreordered = 0;
+  m_packetsduplicated = 0;
 }
 
 void CArtNet::Initialize()
 {
+#if HWFILTER
+  //the port address might have changed, the filter is programmed again when ArtDmx arrives
+  SetFilter(FilterOff);
+#endif
+
+  //seed the random generator with the ip address, since all nodes have the same mac address,
+  //and they might boot or renew their lease at the same time
+  m_random = (((uint16_t)(m_ip[0] ^ m_ip[2]) << 8) | (m_ip[1] ^ m_ip[3])) ^ (uint16_t)micros();
+  if (m_random == 0)
+    m_random = 1;
+
   //ArtPollReply needs to be sent when the controller comes online
-  SendPollReply();
+  SchedulePollReply();
 }
 
 void CArtNet::Process(uint32_t now)
 {
-  //if an ArtPollReply packet is scheduled, send it and clear the flag
-  if (m_sendpollreply && now - m_sendpollreplytime >= m_sendpollreplydelay)
+  //send scheduled ArtPollReply packets, but let the network controller finish transmitting
+  //and handle the packets it received first, unless the reply is getting too late
+  bool sendunicast = m_sendunicastreply;
+  bool sendbroadcast = m_sendpollreply && (int32_t)(now - m_sendpollreplytime) >= 0;
+  if (sendunicast || sendbroadcast)
+  {
+    uint32_t late = now - (sendunicast ? m_sendunicastreplytime : m_sendpollreplytime);
+    if (late < POLLREPLYMAXDELAY && (HalNetTransmitBusy() || HalNetReceivePending() > 0))
+    {
+      sendunicast = false;
+      sendbroadcast = false;
+    }
+  }
+
+  if (sendunicast)
+  {
+    SendPollReply(m_unicastreplyip);
+    m_sendunicastreply = false;
+  }
+  else if (sendbroadcast)
   {
     SendPollReply();
     m_sendpollreply = false;
   }
+
+  //diagnostics requested by ArtPoll are sent after the reply
+  if ((sendunicast || sendbroadcast) && m_senddiag)
+  {
+    SendDiagData();
+    m_senddiag = false;
+  }
+
+#if HWFILTER
+  //a controller that sends ArtDmx as unicast only, after it subscribed to the universes in ArtPollReply,
+  //doesn't need broadcast ArtDmx to be let through, only ArtPoll so it can keep discovering the node
+  uint8_t filter = FilterOff;
+  if (m_dmxtime != 0 && now - m_dmxtime < FILTERIDLETIME && !m_dhcppending)
+  {
+    if (m_broadcastdmxtime != 0 && now - m_broadcastdmxtime < FILTERIDLETIME)
+      filter = FilterDmx;
+    else
+      filter = FilterPoll;
+  }
+  if (filter != m_filter)
+    SetFilter(filter);
+#endif
+}
+
+#if HWFILTER
+void CArtNet::SetFilter(uint8_t filter)
+{
+  //the pattern match can only compare whole bytes, so with more than one universe only the net is matched,
+  //if the universes span more than one net the ArtDmx filter can't be used,
+  //the pattern is an SArtDmx for both, since the network controller reads 16 bytes of it
+  uint16_t lastaddress = m_portaddress + NUM_UNIVERSES - 1;
+  SArtDmx pattern;
+  memcpy(pattern.ID, g_artnetstr, sizeof(g_artnetstr));
+  if (filter == FilterPoll)
+  {
+    //ID and OpCode
+    pattern.OpCode = OpPoll;
+    DBGPRINT("Filtering broadcast ArtPoll\n");
+    HalNetFilterBroadcast(ARTNETPORT, (uint8_t*)&pattern, 0x03FF);
+  }
+  else if (filter == FilterDmx && (m_portaddress >> 8) == (lastaddress >> 8))
+  {
+    pattern.OpCode = OpOutput;
+    pattern.SubUni = m_portaddress & 0xFF;
+    pattern.Net = m_portaddress >> 8;
+
+    //ID, OpCode and Net, and SubUni with a single universe
+    uint16_t mask = 0x03FF | (1 << 15);
+    if (NUM_UNIVERSES == 1)
+      mask |= 1 << 14;
+
+    DBGPRINT("Filtering broadcast ArtDmx for net %u\n", pattern.Net);
+    HalNetFilterBroadcast(ARTNETPORT, (uint8_t*)&pattern, mask);
+  }
+  else if (m_filter != FilterOff)
+  {
+    DBGPRINT("Receiving all broadcast packets\n");
+    HalNetEnableBroadcast();
+  }
+
+  m_filter = filter;
 }
+#endif
 
 void CArtNet::HandlePacket(byte ip[4], uint16_t port, uint8_t* data, uint16_t len)
 {
   //test if the first bytes are "Art-Net", including the null terminator
-  if (len < 10 || strncmp((const char*)data, g_artnetstr, sizeof(g_artnetstr)) != 0)
+  if (len < 10 || memcmp(data, g_artnetstr, sizeof(g_artnetstr)) != 0)
   {
     DBGPRINT("Received packet with invalid Art-Net header of size %u from %u.%u.%u.%u\n", len, ip[0], ip[1], ip[2], ip[3]);
     return;
@@ -181,11 +298,71 @@ void CArtNet::HandlePacket(byte ip[4], uint16_t port, uint8_t* data, uint16_t le
   if (opcode == OpPoll)
     HandlePoll(ip, port, data, len);
   else if (opcode == OpOutput)
-    HandleOutput(data, len);
+    HandleOutput(ip, data, len);
+  else if (opcode == OpNzs)
+    HandleNzs(ip, data, len);
+  else if (opcode == OpAddress)
+    HandleAddress(data, len);
+  else if (opcode == OpSync)
+    HandleSync(data, len);
+  else if (opcode == OpCommand)
+    HandleCommand(data, len);
+  else if (opcode == OpTrigger)
+    HandleTrigger(data, len);
+  else if (opcode == OpTimeCode)
+    HandleTimeCode(data, len);
   else
     DBGPRINT("Unhandled packet with opcode %u:%S\n", opcode, OpcodeToStr(opcode));
 }
 
+uint16_t CArtNet::ClassifyPacket(const uint8_t* data, uint16_t peeklen, uint16_t len)
+{
+  //packets that aren't Art-Net are passed on whole, so HandlePacket can report them
+  if (peeklen < 10 || memcmp(data, g_artnetstr, sizeof(g_artnetstr)) != 0)
+    return len;
+
+  uint16_t opcode = *(uint16_t*)(data + 8);
+  if (opcode == OpOutput)
+  {
+    if (peeklen < sizeof(SArtDmx) - sizeof(((SArtDmx*)data)->Data))
+      return len;
+
+    //drop ArtDmx for other universes, and only read the channels that map to leds
+    const SArtDmx* dmxmsg = (const SArtDmx*)data;
+    if (UniverseIndex(((uint16_t)dmxmsg->Net << 8) | ((uint16_t)dmxmsg->SubUni)) >= NUM_UNIVERSES)
+      return 0;
+
+    return min(len, sizeof(SArtDmx) - sizeof(dmxmsg->Data) + LEDS_PER_UNIVERSE * sizeof(CLed));
+  }
+  else if (opcode == OpNzs)
+  {
+    if (peeklen < sizeof(SArtNzs) - sizeof(((SArtNzs*)data)->Data))
+      return len;
+
+    //run length encoded data can address all leds of the node, so it's read whole
+    const SArtNzs* nzsmsg = (const SArtNzs*)data;
+    if (nzsmsg->StartCode != NZS_STARTCODE ||
+        UniverseIndex(((uint16_t)nzsmsg->Net << 8) | ((uint16_t)nzsmsg->SubUni)) >= NUM_UNIVERSES)
+      return 0;
+
+    return len;
+  }
+  else if (opcode == OpPoll || opcode == OpAddress || opcode == OpSync || opcode == OpCommand ||
+           opcode == OpTrigger || opcode == OpTimeCode)
+  {
+    return len;
+  }
+
+  //opcodes that aren't handled don't need to be read
+  return 0;
+}
+
+uint16_t CArtNet::UniverseIndex(uint16_t portaddress)
+{
+  //port address 0 is always output on the first universe
+  return portaddress == 0 ? 0 : portaddress - m_portaddress;
+}
+
 void CArtNet::HandlePoll(byte ip[4], uint16_t port, uint8_t* data, uint16_t len)
 {
   if (len < sizeof(SArtPoll))
@@ -206,23 +383,24 @@ void CArtNet::HandlePoll(byte ip[4], uint16_t port, uint8_t* data, uint16_t len)
   //data is valid
   m_controller.OnValidData();
 
-  if (port == ARTNETPORT)
+  //the timing statistics are sent as low priority diagnostics
+  if (pollmsg->TalkToMe.SendDiag && pollmsg->Priority <= DpLow)
   {
-    //schedule a send of an ArtPollReply packet, if not already done
-    if (!m_sendpollreply)
-    {
-      m_sendpollreply = true;
-      m_sendpollreplytime = millis();
-    }
+    m_senddiag = true;
+    if (pollmsg->TalkToMe.Unicast)
+      memcpy(m_diagip, ip, sizeof(m_diagip));
+    else
+      memcpy(m_diagip, g_broadcastaddress, sizeof(m_diagip));
   }
+
+  //ArtPoll on the art-net port is answered with a broadcast, otherwise the reply is sent as unicast
+  if (port == ARTNETPORT)
+    SchedulePollReply();
   else
-  {
-    //send an artpollreply as unicast
-    SendPollReply(ip);
-  }
+    SchedulePollReply(ip);
 }
 
-void CArtNet::HandleOutput(uint8_t* data, uint16_t len)
+void CArtNet::HandleOutput(byte ip[4], uint8_t* data, uint16_t len)
 {
   if (len < sizeof(SArtDmx))
   {
@@ -233,16 +411,32 @@ void CArtNet::HandleOutput(uint8_t* data, uint16_t len)
   SArtDmx* dmxmsg = (SArtDmx*)data;
 
   uint16_t portaddress = ((uint16_t)dmxmsg->Net << 8) | ((uint16_t)dmxmsg->SubUni);
-  if (portaddress != 0 && portaddress != m_portaddress)
+  uint16_t universe = UniverseIndex(portaddress);
+  if (universe >= NUM_UNIVERSES)
+  {
+    DBGPRINT("Received dmx output for another universe %u, my universes are %u to %u\n",
+             portaddress, m_portaddress, m_portaddress + NUM_UNIVERSES - 1);
+    return;
+  }
+
+  int8_t source = FindSource(ip, millis());
+  if (source < 0)
   {
-    DBGPRINT("Received dmx output for another universe %u, my universe is %u\n", portaddress, m_portaddress);
+    DBGPRINT("Received dmx output from a third source %u.%u.%u.%u, already merging two sources\n", ip[0], ip[1], ip[2], ip[3]);
     return;
   }
 
   //data is valid
   m_controller.OnValidData();
+  m_dmxtime = millis();
+  if (HalNetReceivedBroadcast())
+    m_broadcastdmxtime = m_dmxtime;
 
-  DBGPRINT("Received dmx output for my universe %u\n", portaddress);
+  DBGPRINT("Received dmx output for my universe %u from source %i\n", portaddress, source);
+
+  //discard packets that arrive after a newer one, or twice
+  if (!CheckSequence(m_sources[source], universe, dmxmsg->Sequence))
+    return;
 
   //check if the length specified in the art-net packet is valid
   //and is less or equal than the actual number of databytes sent
@@ -256,73 +450,466 @@ void CArtNet::HandleOutput(uint8_t* data, uint16_t len)
   DBGPRINT("Received %u dmx channels\n", (int)length);
 
   //pass dmx data buffer to the controller
-  m_controller.OnDmxData(dmxmsg->Data, length);
+  m_controller.OnDmxData(source, universe, dmxmsg->Data, length);
+}
+
+int8_t CArtNet::FindSource(byte ip[4], uint32_t now)
+{
+  int8_t source = -1;
+  int8_t freesource = -1;
+  int8_t oldest = 0;
+  for (int8_t i = 0; i < NUM_SOURCES; i++)
+  {
+    SArtNetSource& artnetsource = m_sources[i];
+
+    //drop sources that stopped sending
+    if (artnetsource.active && now - artnetsource.time >= MERGETIMEOUT)
+    {
+      DBGPRINT("Source %u.%u.%u.%u timed out\n", artnetsource.ip[0], artnetsource.ip[1], artnetsource.ip[2], artnetsource.ip[3]);
+      artnetsource.active = false;
+    }
+
+    if (artnetsource.active && memcmp(artnetsource.ip, ip, sizeof(artnetsource.ip)) == 0)
+      source = i;
+    else if (!artnetsource.active && freesource < 0)
+      freesource = i;
+
+    if (now - artnetsource.time > now - m_sources[oldest].time)
+      oldest = i;
+  }
+
+  if (source < 0)
+  {
+    //a new source takes a free slot, if there is none and merging is enabled it is ignored,
+    //otherwise it replaces the source that sent least recently
+    if (freesource >= 0)
+      source = freesource;
+    else if (MERGE)
+      return -1;
+    else
+      source = oldest;
+
+    memcpy(m_sources[source].ip, ip, sizeof(m_sources[source].ip));
+    memset(m_sources[source].sequence, 0, sizeof(m_sources[source].sequence));
+    m_sources[source].active = true;
+  }
+  m_sources[source].time = now;
+
+  //the next ArtDmx after AcCancelMerge makes its source the only one
+  if (m_cancelmerge)
+  {
+    for (int8_t i = 0; i < NUM_SOURCES; i++)
+      m_sources[i].active = i == source;
+    m_cancelmerge = false;
+  }
+
+  bool merging = MERGE && m_sources[0].active && m_sources[1].active;
+  if (merging != m_merging)
+  {
+    DBGPRINT("%S merging\n", merging ? PSTR("Started") : PSTR("Stopped"));
+    m_merging = merging;
+  }
+
+  return source;
+}
+
+bool CArtNet::CheckSequence(SArtNetSource& source, uint8_t universe, uint8_t sequence)
+{
+  //sequence 0 means the controller doesn't use sequence numbers
+  uint8_t last = source.sequence[universe];
+  source.sequence[universe] = sequence;
+  if (sequence == 0 || last == 0)
+    return true;
+
+  //the sequence goes from 1 to 255, and wraps around to 1
+  int16_t delta = (int16_t)sequence - last;
+  if (delta < 0)
+    delta += 255;
+
+  if (delta == 0)
+  {
+    DBGPRINT("Discarding duplicate dmx output with sequence %u\n", sequence);
+    m_packetsduplicated++;
+    return false;
+  }
+  else if (delta >= 255 - SEQUENCEWINDOW)
+  {
+    DBGPRINT("Discarding late dmx output with sequence %u, last sequence is %u\n", sequence, last);
+    source.sequence[universe] = last;
+    m_packetsreordered++;
+    return false;
+  }
+  else if (delta <= 128)
+  {
+    m_packetslost += delta - 1;
+  }
+
+  return true;
+}
+
+void CArtNet::HandleNzs(byte ip[4], uint8_t* data, uint16_t len)
+{
+  SArtNzs* nzsmsg = (SArtNzs*)data;
+  uint16_t headersize = sizeof(SArtNzs) - sizeof(nzsmsg->Data);
+  if (len < headersize + sizeof(SNzsHeader))
+  {
+    DBGPRINT("Received OpNzs with invalid size %u\n", len);
+    return;
+  }
+
+  //other start codes are dmx data for other devices
+  SNzsHeader* header = (SNzsHeader*)nzsmsg->Data;
+  uint16_t manufacturer = ((uint16_t)header->ManufacturerHi << 8) | (uint16_t)header->ManufacturerLo;
+  if (nzsmsg->StartCode != NZS_STARTCODE || manufacturer != NZS_MANUFACTURER)
+  {
+    DBGPRINT("Received OpNzs with start code %u manufacturer %u\n", nzsmsg->StartCode, manufacturer);
+    return;
+  }
+
+  uint16_t portaddress = ((uint16_t)nzsmsg->Net << 8) | ((uint16_t)nzsmsg->SubUni);
+  uint16_t universe = UniverseIndex(portaddress);
+  if (universe >= NUM_UNIVERSES)
+  {
+    DBGPRINT("Received OpNzs for another universe %u\n", portaddress);
+    return;
+  }
+
+  int8_t source = FindSource(ip, millis());
+  if (source < 0)
+  {
+    DBGPRINT("Received OpNzs from a third source %u.%u.%u.%u, already merging two sources\n", ip[0], ip[1], ip[2], ip[3]);
+    return;
+  }
+
+  //data is valid, m_dmxtime is left alone because the hardware filter would drop broadcast ArtNzs
+  m_controller.OnValidData();
+
+  if (!CheckSequence(m_sources[source], universe, nzsmsg->Sequence))
+    return;
+
+  uint16_t maxlength = min(512, len - headersize);
+  uint16_t length = ((uint16_t)nzsmsg->LengthHi << 8) | (uint16_t)nzsmsg->Length;
+  if (length > maxlength || length < sizeof(SNzsHeader))
+  {
+    DBGPRINT("Received OpNzs with invalid length %u\n", length);
+    length = maxlength;
+  }
+
+  uint16_t start = ((uint16_t)header->StartHi << 8) | (uint16_t)header->StartLo;
+  DBGPRINT("Received %u bytes of led data starting at %u, flags %u\n", length, start, header->Flags);
+
+  m_controller.OnNzsData(universe, start, header->Flags, nzsmsg->Data + sizeof(SNzsHeader), length - sizeof(SNzsHeader));
+}
+
+void CArtNet::HandleAddress(uint8_t* data, uint16_t len)
+{
+  if (len < sizeof(SArtAddress))
+  {
+    DBGPRINT("Received OpAddress with invalid size %u\n", len);
+    return;
+  }
+
+  SArtAddress* addressmsg = (SArtAddress*)data;
+
+  //the port address is derived from the ip address, so only the merge commands are handled,
+  //this node merges all of its ports the same way
+  uint8_t command = addressmsg->Command;
+  DBGPRINT("Address command %u\n", command);
+  if (command == AcCancelMerge)
+    m_cancelmerge = true;
+  else if (command >= AcMergeLtp0 && command <= AcMergeLtp3)
+    m_mergeltp = true;
+  else if (command >= AcMergeHtp0 && command <= AcMergeHtp3)
+    m_mergeltp = false;
+
+  //data is valid
+  m_controller.OnValidData();
+
+  //ArtAddress is answered with an ArtPollReply
+  SchedulePollReply();
+}
+
+void CArtNet::HandleSync(uint8_t* data, uint16_t len)
+{
+  if (len < sizeof(SArtSync))
+  {
+    DBGPRINT("Received OpSync with invalid size %u\n", len);
+    return;
+  }
+
+  //data is valid
+  m_controller.OnValidData();
+
+  //show the dmx data received since the last ArtSync
+  m_controller.OnSync();
 }
 
+void CArtNet::HandleTrigger(uint8_t* data, uint16_t len)
+{
+  if (len < sizeof(SArtTrigger) - sizeof(((SArtTrigger*)data)->Data))
+  {
+    DBGPRINT("Received OpTrigger with invalid size %u\n", len);
+    return;
+  }
+
+  SArtTrigger* triggermsg = (SArtTrigger*)data;
+
+  //triggers are either for all nodes, or for this OEM
+  uint16_t oem = ((uint16_t)triggermsg->OemHi << 8) | (uint16_t)triggermsg->OemLo;
+  if (oem != 0xFFFF && oem != ARTNETOEM)
+  {
+    DBGPRINT("Received OpTrigger for OEM %04x\n", oem);
+    return;
+  }
+
+  //the macros are the effects, see effects.h
+  if (triggermsg->Key != KeyMacro)
+  {
+    DBGPRINT("Ignoring OpTrigger with key %u\n", triggermsg->Key);
+    return;
+  }
+
+  //data is valid
+  m_controller.OnValidData();
+
+  uint16_t length = min(sizeof(triggermsg->Data), len - (sizeof(SArtTrigger) - sizeof(triggermsg->Data)));
+  m_controller.OnTrigger(triggermsg->SubKey, triggermsg->Data, length);
+}
+
+void CArtNet::HandleTimeCode(uint8_t* data, uint16_t len)
+{
+  if (len < sizeof(SArtTimeCode))
+  {
+    DBGPRINT("Received OpTimeCode with invalid size %u\n", len);
+    return;
+  }
+
+  SArtTimeCode* timecodemsg = (SArtTimeCode*)data;
+
+  //data is valid
+  m_controller.OnValidData();
+
+  m_controller.OnTimeCode(timecodemsg->Hours, timecodemsg->Minutes, timecodemsg->Seconds, timecodemsg->Frames, timecodemsg->Type);
+}
+
+void CArtNet::HandleCommand(uint8_t* data, uint16_t len)
+{
+  if (len < sizeof(SArtCommand) - sizeof(((SArtCommand*)data)->Data))
+  {
+    DBGPRINT("Received OpCommand with invalid size %u\n", len);
+    return;
+  }
+
+  SArtCommand* commandmsg = (SArtCommand*)data;
+
+  //commands are either for all nodes, or for this manufacturer
+  if (!(commandmsg->EstaManHi == 0xFF && commandmsg->EstaManLo == 0xFF) &&
+      !(commandmsg->EstaManHi == 'O' && commandmsg->EstaManLo == 'L'))
+  {
+    DBGPRINT("Received OpCommand for manufacturer %02x%02x\n", commandmsg->EstaManHi, commandmsg->EstaManLo);
+    return;
+  }
+
+  uint16_t maxlength = min(sizeof(commandmsg->Data), len - (sizeof(SArtCommand) - sizeof(commandmsg->Data)));
+  uint16_t length = ((uint16_t)commandmsg->LengthHi << 8) | (uint16_t)commandmsg->Length;
+  length = min(length, maxlength);
+
+  //the text is split into "keyword=value&" pairs in place, the terminating & is optional
+  //the network buffer always has room for a terminator after the packet
+  char* text = (char*)commandmsg->Data;
+  text[length] = 0;
+  while (*text)
+  {
+    char* keyword = text;
+    char* value = NULL;
+    for (; *text && *text != '&'; text++)
+    {
+      if (*text == '=' && !value)
+      {
+        *text = 0;
+        value = text + 1;
+      }
+    }
+
+    if (*text)
+      *text++ = 0;
+
+    if (value)
+    {
+      DBGPRINT("Command %s=%s\n", keyword, value);
+      m_controller.OnCommand(keyword, value);
+    }
+  }
+
+  //data is valid
+  m_controller.OnValidData();
+}
+
+void CArtNet::SendDiagData()
+{
+  DBGPRINT("Sending DiagData\n");
+
+  SArtDiagData* diag = (SArtDiagData*)m_transmitbuf;
+  memset(diag, 0, sizeof(SArtDiagData) - sizeof(diag->Data));
+  memcpy(diag->ID, g_artnetstr, sizeof(g_artnetstr));
+  diag->OpCode = OpDiagData;
+  diag->ProtVerLow = 14;
+  diag->Priority = DpLow;
+
+  //the length includes the null terminator
+  uint16_t length = m_controller.FormatStats((char*)diag->Data, sizeof(diag->Data)) + 1;
+  diag->LengthHi = length >> 8;
+  diag->Length = length & 0xFF;
+
+  m_controller.Transmit(m_transmitbuf, sizeof(SArtDiagData) - sizeof(diag->Data) + length, ARTNETPORT, m_diagip, ARTNETPORT);
+}
+
+void CArtNet::SchedulePollReply(uint8_t* ip /*= NULL*/)
+{
+  uint32_t now = millis();
+  if (ip)
+  {
+    //ip points into the receive buffer, which sending overwrites
+    uint8_t pollerip[4];
+    memcpy(pollerip, ip, sizeof(pollerip));
+
+    //there's room for one unicast reply, if another poller is waiting for one, send that first
+    if (m_sendunicastreply && memcmp(pollerip, m_unicastreplyip, sizeof(m_unicastreplyip)) != 0)
+      SendPollReply(m_unicastreplyip);
+
+    //a unicast reply only goes to the poller, so it's sent without jitter
+    memcpy(m_unicastreplyip, pollerip, sizeof(m_unicastreplyip));
+    if (!m_sendunicastreply)
+    {
+      m_sendunicastreply = true;
+      m_sendunicastreplytime = now;
+    }
+  }
+  else if (!m_sendpollreply)
+  {
+    //if a broadcast reply is already scheduled, that one answers this request too
+    m_sendpollreply = true;
+    m_sendpollreplytime = now + Random() % POLLREPLYWINDOW;
+    DBGPRINT("Scheduled PollReply in %lu ms\n", m_sendpollreplytime - now);
+  }
+}
+
+//16 bit xorshift
+uint16_t CArtNet::Random()
+{
+  m_random ^= m_random << 7;
+  m_random ^= m_random >> 9;
+  m_random ^= m_random << 8;
+  return m_random;
+}
+
+//the parts of ArtPollReply that never change, SendPollReply copies this from flash
+//and only fills in the address, the ports, status and node report
+static const SArtPollReply g_pollreplytemplate PROGMEM =
+{
+  "Art-Net",                               //ID
+  OpPollReply,                             //OpCode
+  {0, 0, 0, 0},                            //IpAddress
+  ARTNETPORT,                              //Port
+  5,                                       //VersInfoH
+  57,                                      //VersInfo
+  0,                                       //NetSwitch
+  0,                                       //SubSwitch
+  ARTNETOEM >> 8,                          //OemHi
+  ARTNETOEM & 0xFF,                        //Oem
+  0,                                       //UbeaVersion
+  {0, 0, 0, 0, PaPanel, 0},                //Status1, the port address follows the ip address
+  'L',                                     //EstaManLo
+  'O',                                     //EstaManHi
+  "LED strip",                             //ShortName
+  "LED strip controller for OHM 2013",     //LongName
+  "",                                      //NodeReport
+  0,                                       //NumPortsHi
+  0,                                       //NumPortsLo
+  {},                                      //PortTypes
+  {},                                      //GoodInput
+  {},                                      //GoodOutput
+  {0, 0, 0, 0},                            //SwIn
+  {0, 0, 0, 0},                            //SwOut
+  0,                                       //SwVideo
+  {0, 0, 0, 0, 0, 0, 0, 0},                //SwMacro
+  {0, 0, 0, 0, 0, 0, 0, 0},                //SwRemote
+  {0, 0, 0},                               //Spare
+  StNode,                                  //Style
+  {0, 0, 0, 0, 0, 0},                      //MAC
+  {0, 0, 0, 0},                            //BindIp
+  0,                                       //BindIndex
+  {0, !STATIC, !STATIC, 1, 0, 0, 0, 0},    //Status2
+  {},                                      //GoodOutputB
+  0,                                       //Status3
+  {0, 0, 0, 0, 0, 0},                      //DefaultRespUid
+  0,                                       //UserHi
+  0,                                       //UserLo
+  0,                                       //RefreshRateHi
+  0,                                       //RefreshRateLo
+  {},                                      //Filler
+};
+
 void CArtNet::SendPollReply(uint8_t* ip /*= NULL*/)
 {
   DBGPRINT("Sending PollReply\n");
 
   SArtPollReply* reply = (SArtPollReply*)m_transmitbuf;
 
-  memcpy(reply->ID, g_artnetstr, sizeof(g_artnetstr));
-  reply->OpCode = OpPollReply;
+  memcpy_P(reply, &g_pollreplytemplate, sizeof(SArtPollReply));
   memcpy(reply->IpAddress, m_ip, 4);
-  reply->Port = ARTNETPORT;
-  reply->VersInfoH = 5;
-  reply->VersInfo = 57;
-  reply->NetSwitch = (m_portaddress & 0x7F00) >> 8;
-  reply->SubSwitch = (m_portaddress & 0xF0) >> 4;
-  reply->OemHi = 0;
-  reply->Oem = 0;
-  reply->UbeaVersion = 0;
-  reply->Status1.IndicatorState = 0;
-  reply->Status1.PortAddressProgrammingAuthority = 0;
-  reply->Status1.unused = 0;
-  reply->Status1.BootedFromROM = 0;
-  reply->Status1.CapableOfRemoteDeviceManagement = 0;
-  reply->Status1.UBEAPresent = 0;
-  reply->EstaManLo = 'L';
-  reply->EstaManHi = 'O';
-  strcpy((char*)reply->ShortName, "LED strip");
-  strcpy((char*)reply->LongName, "LED strip controller for OHM 2013");
-  memset(reply->NodeReport, 0, sizeof(reply->NodeReport));
-  reply->NumPortsHi = 0;
-  reply->NumPortsLo = 2;
-  reply->PortTypes[0].CanOutputDataFromArtNet = 1;
-  reply->PortTypes[0].CanInputDataToArtNet = 0;
-  reply->PortTypes[0].Type = DMX512;
-  reply->PortTypes[1].CanOutputDataFromArtNet = 1;
-  reply->PortTypes[1].CanInputDataToArtNet = 0;
-  reply->PortTypes[1].Type = DMX512;
-  memset(reply->PortTypes + 2, 0, sizeof(reply->PortTypes[0]) * 2);
-  memset(reply->GoodInput, 0, sizeof(reply->GoodInput));
-  memset(reply->GoodOutput, 0, sizeof(reply->GoodOutput));
-  memset(reply->SwIn, 0, sizeof(reply->SwIn));
-  reply->SwOut[0] = 0;
-  reply->SwOut[1] = m_portaddress & 15;
-  reply->SwOut[2] = 0;
-  reply->SwOut[3] = 0;
-  reply->SwVideo = 0;
-  memset(&reply->SwMacro, 0, sizeof(reply->SwMacro));
-  memset(&reply->SwRemote, 0, sizeof(reply->SwRemote));
-  memset(reply->Spare, 0, sizeof(reply->Spare));
-  reply->Style = StNode;
+  snprintf_P((char*)reply->NodeReport, sizeof(reply->NodeReport), PSTR("#%04x [%04u] %ufps %uus lost %u late %u dup %u"),
+             RcPowerOk, m_pollreplycount++, m_controller.Fps(), m_controller.ShowTime(),
+             Clamp16(m_packetslost), Clamp16(m_packetsreordered), Clamp16(m_packetsduplicated));
   memcpy(reply->MAC, m_mac, sizeof(reply->MAC));
   memcpy(reply->BindIp, m_ip, 4);
-  reply->BindIndex = 0;
-  reply->Status2.unused = 0;
-  reply->Status2.NodeSupports15BitPortAddress = 1;
-  reply->Status2.NodeIsDHCPCapable = !STATIC;
-  reply->Status2.NodesIPIsDHCPConfigured = !STATIC;
-  reply->Status2.ProductSupportsWebBrowserConfiguration = 0;
-  memset(reply->Filler, 0, sizeof(reply->Filler));
-  
-  //if ip is not set, send it to the broadcast address
-  //if it is set, send it as unicast at art-net port minus one
-  if (!ip)
-    m_controller.Transmit(m_transmitbuf, sizeof(SArtPollReply), ARTNETPORT, g_broadcastaddress, ARTNETPORT);
-  else
-    m_controller.Transmit(m_transmitbuf, sizeof(SArtPollReply), ARTNETPORT - 1, ip, ARTNETPORT - 1);
+
+  uint32_t dmxtime = m_controller.DmxTime();
+  bool     outputting = dmxtime != 0 && millis() - dmxtime < OUTPUTIDLETIME;
+
+  //a reply describes at most 4 ports, which share the net and subnet of their port address,
+  //so the universes are split over pages, each with the next bind index,
+  //a controller subscribes to a universe by sending its ArtDmx unicast to the ip address of the page
+  uint8_t universe = 0;
+  for (uint8_t page = 1; universe < NUM_UNIVERSES; page++)
+  {
+    uint16_t portaddress = m_portaddress + universe;
+    reply->NetSwitch = (portaddress >> 8) & 0x7F;
+    reply->SubSwitch = (portaddress >> 4) & 0x0F;
+    reply->BindIndex = page;
+
+    uint8_t ports = 0;
+    for (uint8_t port = 0; port < 4; port++)
+    {
+      uint16_t address = m_portaddress + universe;
+      bool     used = universe < NUM_UNIVERSES && (address >> 4) == (portaddress >> 4);
+
+      reply->PortTypes[port].Type = DMX512;
+      reply->PortTypes[port].CanOutputDataFromArtNet = used;
+      reply->SwOut[port] = used ? address & 0x0F : 0;
+
+      SGoodOutput& goodoutput = reply->GoodOutput[port];
+      goodoutput.DataIsBeingTransmitted = used && outputting;
+      goodoutput.OutputIsMergingArtNetData = used && m_merging;
+      goodoutput.MergeModeIsLTP = used && m_mergeltp;
+
+      reply->GoodOutputB[port].RdmIsDisabled = used;
+      reply->GoodOutputB[port].OutputIsContinuous = used;
+
+      if (used)
+      {
+        universe++;
+        ports++;
+      }
+    }
+    reply->NumPortsLo = ports;
+
+    //if ip is not set, send it to the broadcast address
+    //if it is set, send it as unicast at art-net port minus one
+    if (!ip)
+      m_controller.Transmit(m_transmitbuf, sizeof(SArtPollReply), ARTNETPORT, g_broadcastaddress, ARTNETPORT);
+    else
+      m_controller.Transmit(m_transmitbuf, sizeof(SArtPollReply), ARTNETPORT - 1, ip, ARTNETPORT - 1);
+  }
 }
 
@@ -3,6 +3,56 @@
 
 #define ARTNETPORT 6454
 
+//OEM code sent in ArtPollReply, ArtTrigger for this OEM or for all (0xFFFF) is handled
+#define ARTNETOEM 0x0000
+
+//number of consecutive universes the node outputs, starting at its port address
+#ifndef NUM_UNIVERSES
+#define NUM_UNIVERSES 1
+#endif
+
+#if NUM_UNIVERSES > 16
+#error NUM_UNIVERSES can be at most 16
+#endif
+
+//while ArtDmx for this node keeps arriving, program the receive filter of the network controller
+//to only let unicast packets and broadcast ArtDmx for this node through,
+//broadcast ArtPoll and ARP requests are then dropped too, so the node can only be discovered
+//with unicast ArtPoll on port 6453 while the filter is on,
+//when the ArtDmx only arrives as unicast, because the controller subscribed to the universes in ArtPollReply,
+//broadcast ArtPoll is let through instead, and every other broadcast packet is dropped,
+//the controller keeps the node in its ARP cache with unicast ARP requests, which still get through,
+//if it goes back to broadcast ArtDmx, that is dropped until the filter turns off after FILTERIDLETIME,
+//the filter stays off while DHCP confirms a stored lease, since its replies can be broadcast
+#ifndef HWFILTER
+#define HWFILTER 0
+#endif
+
+//ArtNzs doesn't turn the filter on, broadcast ArtNzs is dropped while ArtDmx keeps it on
+
+//the filter is turned off when no ArtDmx for this node was received for this many milliseconds,
+//and switches from ArtDmx to ArtPoll when no broadcast ArtDmx was received for this long
+#define FILTERIDLETIME 2000
+
+//ArtPollReply reports data is being output while led data was received within this many milliseconds
+#define OUTPUTIDLETIME 2000
+
+//values of CArtNet::m_filter
+enum FilterMode
+{
+  FilterOff,  //all broadcast packets are received
+  FilterDmx,  //broadcast ArtDmx for the net of this node
+  FilterPoll, //broadcast ArtPoll, ArtDmx arrives as unicast
+};
+
+//a broadcast ArtPollReply is sent at a random time within this many milliseconds after it's requested,
+//so that the replies are spread out when many nodes are polled, boot or renew their DHCP lease at the same time
+#define POLLREPLYWINDOW 1000
+
+//while the network controller is transmitting or has received packets waiting,
+//ArtPollReply is postponed, until it's this many milliseconds late
+#define POLLREPLYMAXDELAY 500
+
 enum Opcode
 {
   OpPoll = 0x2000, //This is an ArtPoll packet, no other data is contained in this UDP packet.
@@ -11,6 +61,7 @@ enum Opcode
   OpCommand = 0x2400, //Used to send text based parameter commands.
   OpOutput = 0x5000, //This is an ArtDmx data packet. It contains zero start code DMX512 information for a single Universe.
   OpNzs = 0x5100, //This is an ArtNzs data packet. It contains non-zero start code (except RDM) DMX512 information for a single Universe.
+  OpSync = 0x5200, //This is an ArtSync data packet. It is used to force synchronous transfer of ArtDmx packets to a node’s output.
   OpAddress = 0x6000, //This is an ArtAddress packet. It contains remote programming information for a Node.
   OpInput = 0x7000, //This is an ArtInput packet. It contains enable – disable data for DMX inputs.
   OpTodRequest = 0x8000, //This is an ArtTodRequest packet. It is used to request a Table of Devices (ToD) for RDM discovery.
@@ -69,6 +120,20 @@ enum NodeReport
   RcFirmwareFail = 0x000e, //Last attempt to upload new firmware failed.
 };
 
+enum AddressCommand
+{
+  AcNone = 0x00, //No action.
+  AcCancelMerge = 0x01, //If Node is currently in merge mode, cancel merge mode upon receipt of next ArtDmx packet.
+  AcLedNormal = 0x02, //The front panel indicators of the Node operate normally.
+  AcLedMute = 0x03, //The front panel indicators of the Node are disabled and switched off.
+  AcLedLocate = 0x04, //Rapid flashing of the Node’s front panel indicators.
+  AcResetRxFlags = 0x05, //Resets the Node’s Sip, Text, Test and data error flags.
+  AcMergeLtp0 = 0x10, //Set DMX Port 0 to Merge in LTP mode.
+  AcMergeLtp3 = 0x13, //Set DMX Port 3 to Merge in LTP mode.
+  AcMergeHtp0 = 0x50, //Set DMX Port 0 to Merge in HTP (default) mode.
+  AcMergeHtp3 = 0x53, //Set DMX Port 3 to Merge in HTP (default) mode.
+};
+
 enum Style
 {
   StNode = 0x00, //A DMX to / from Art-Net device
@@ -92,11 +157,11 @@ enum Datatype
 
 struct STalkToMe
 {
-  uint8_t unused1 : 4;
-  uint8_t Unicast : 1;
-  uint8_t SendDiag : 1;
+  uint8_t unused1 : 1;
   uint8_t SendPollOnChange : 1;
-  uint8_t unused2 : 1;
+  uint8_t SendDiag : 1;
+  uint8_t Unicast : 1;
+  uint8_t unused2 : 4;
 } __attribute__((packed));
 
 struct SArtPoll
@@ -109,77 +174,99 @@ struct SArtPoll
   uint8_t   Priority;
 } __attribute__((packed));
 
+//the bit fields below start at bit 0, which is how gcc lays them out on the ATmega and on x86
+
+//values of SStatus1.PortAddressProgrammingAuthority
+enum PortAddressAuthority
+{
+  PaUnknown  = 0, //Port-Address Programming Authority unknown.
+  PaPanel    = 1, //All Port-Address set by front panel controls.
+  PaNetwork  = 2, //All or part of Port-Address programmed by network or Web browser.
+};
+
 struct SStatus1
 {
-  uint8_t IndicatorState : 2;
-  uint8_t PortAddressProgrammingAuthority : 2;
-  uint8_t unused : 1;
-  uint8_t BootedFromROM : 1;
-  uint8_t CapableOfRemoteDeviceManagement : 1;
   uint8_t UBEAPresent : 1;
+  uint8_t CapableOfRemoteDeviceManagement : 1;
+  uint8_t BootedFromROM : 1;
+  uint8_t unused : 1;
+  uint8_t PortAddressProgrammingAuthority : 2;
+  uint8_t IndicatorState : 2;
 } __attribute__((packed));
 
 struct SPortType
 {
-  uint8_t  CanOutputDataFromArtNet : 1;
-  uint8_t  CanInputDataToArtNet : 1;
   Datatype Type : 6;
+  uint8_t  CanInputDataToArtNet : 1;
+  uint8_t  CanOutputDataFromArtNet : 1;
 } __attribute__((packed));
 
 struct SGoodInput
 {
-  uint8_t Datareceived : 1;
-  uint8_t ChannelIncludesDMX512TestPackets : 1;
-  uint8_t ChannelIncludesDMX512SIPs : 1;
-  uint8_t ChannelIncludesDMX512TextPackets : 1;
-  uint8_t InputIsDisabled : 1;
+  uint8_t InputIsSacn : 1;
+  uint8_t unused : 1;
   uint8_t ReceiveErrorsDetected : 1;
-  uint8_t unused : 2;
+  uint8_t InputIsDisabled : 1;
+  uint8_t ChannelIncludesDMX512TextPackets : 1;
+  uint8_t ChannelIncludesDMX512SIPs : 1;
+  uint8_t ChannelIncludesDMX512TestPackets : 1;
+  uint8_t Datareceived : 1;
 } __attribute__((packed));
 
 struct SGoodOutput
 {
-  uint8_t DataIsBeingTransmitted : 1;
-  uint8_t ChannelIncludesDMX512TestPackets : 1;
-  uint8_t ChannelIncludesDMX512SIPs : 1;
-  uint8_t ChannelIncludesDMX512TextPackets : 1;
-  uint8_t OutputIsMergingArtNetData : 1;
-  uint8_t DMXOutputShortDetectedOnPowerUp : 1;
+  uint8_t OutputIsSacn : 1;
   uint8_t MergeModeIsLTP : 1;
-  uint8_t unused : 1;
+  uint8_t DMXOutputShortDetectedOnPowerUp : 1;
+  uint8_t OutputIsMergingArtNetData : 1;
+  uint8_t ChannelIncludesDMX512TextPackets : 1;
+  uint8_t ChannelIncludesDMX512SIPs : 1;
+  uint8_t ChannelIncludesDMX512TestPackets : 1;
+  uint8_t DataIsBeingTransmitted : 1;
+} __attribute__((packed));
+
+//Art-Net 4
+struct SGoodOutputB
+{
+  uint8_t unused : 6;
+  uint8_t OutputIsContinuous : 1;
+  uint8_t RdmIsDisabled : 1;
 } __attribute__((packed));
 
 struct SSwMacro
 {
-  uint8_t Macro8Active : 1;
-  uint8_t Macro7Active : 1;
-  uint8_t Macro6Active : 1;
-  uint8_t Macro5Active : 1;
-  uint8_t Macro4Active : 1;
-  uint8_t Macro3Active : 1;
-  uint8_t Macro2Active : 1;
   uint8_t Macro1Active : 1;
+  uint8_t Macro2Active : 1;
+  uint8_t Macro3Active : 1;
+  uint8_t Macro4Active : 1;
+  uint8_t Macro5Active : 1;
+  uint8_t Macro6Active : 1;
+  uint8_t Macro7Active : 1;
+  uint8_t Macro8Active : 1;
 } __attribute__((packed));
 
 struct SSwRemote
 {
-  uint8_t Remote8Active : 1;
-  uint8_t Remote7Active : 1;
-  uint8_t Remote6Active : 1;
-  uint8_t Remote5Active : 1;
-  uint8_t Remote4Active : 1;
-  uint8_t Remote3Active : 1;
-  uint8_t Remote2Active : 1;
   uint8_t Remote1Active : 1;
+  uint8_t Remote2Active : 1;
+  uint8_t Remote3Active : 1;
+  uint8_t Remote4Active : 1;
+  uint8_t Remote5Active : 1;
+  uint8_t Remote6Active : 1;
+  uint8_t Remote7Active : 1;
+  uint8_t Remote8Active : 1;
 } __attribute__((packed));
 
 struct SStatus2
 {
-  uint8_t unused : 4;
-  uint8_t NodeSupports15BitPortAddress : 1;
-  uint8_t NodeIsDHCPCapable : 1;
-  uint8_t NodesIPIsDHCPConfigured : 1;
   uint8_t ProductSupportsWebBrowserConfiguration : 1;
+  uint8_t NodesIPIsDHCPConfigured : 1;
+  uint8_t NodeIsDHCPCapable : 1;
+  uint8_t NodeSupports15BitPortAddress : 1;
+  uint8_t NodeCanSwitchArtNetSacn : 1;
+  uint8_t NodeIsSquawking : 1;
+  uint8_t NodeCanSwitchOutputStyle : 1;
+  uint8_t NodeCanControlRdm : 1;
 } __attribute__((packed));
 
 struct SArtPollReply
@@ -217,7 +304,14 @@ struct SArtPollReply
   uint8_t     BindIp[4];
   uint8_t     BindIndex;
   SStatus2    Status2;
-  uint8_t     Filler[26];
+  SGoodOutputB GoodOutputB[4];
+  uint8_t     Status3;
+  uint8_t     DefaultRespUid[6];
+  uint8_t     UserHi;
+  uint8_t     UserLo;
+  uint8_t     RefreshRateHi;
+  uint8_t     RefreshRateLo;
+  uint8_t     Filler[11];
 } __attribute__((packed));
 
 struct SArtDmx
@@ -235,6 +329,174 @@ struct SArtDmx
   uint8_t     Data[2]; //minimum number of dmx bytes sent is 2
 } __attribute__((packed));
 
+struct SArtNzs
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     Sequence;
+  uint8_t     StartCode;
+  uint8_t     SubUni;
+  uint8_t     Net;
+  uint8_t     LengthHi;
+  uint8_t     Length;
+  uint8_t     Data[2];
+} __attribute__((packed));
+
+//ArtNzs with the manufacturer specific start code and this node's ESTA code carries run length encoded led data,
+//it starts at the led StartHi/StartLo of the universe and can run on into the following universes of the node,
+//a frame can be split over several packets, the leds are shown when the one with NzsLastPacket arrives,
+//in PALETTE builds a led is a single palette index instead of 3 bytes
+#define NZS_STARTCODE    0x91
+#define NZS_MANUFACTURER 0x4F4C //"OL", the same as EstaManHi and EstaManLo in ArtPollReply
+
+struct SNzsHeader
+{
+  uint8_t     ManufacturerHi;
+  uint8_t     ManufacturerLo;
+  uint8_t     Flags;
+  uint8_t     StartHi;
+  uint8_t     StartLo;
+} __attribute__((packed));
+
+enum NzsFlags
+{
+  NzsLastPacket = 0x01, //the frame is complete, show it
+  NzsPalette    = 0x02, //the data is 3 bytes for every palette color from the start one, in PALETTE builds
+  NzsCues       = 0x04, //the data is written into the cue table from the start byte, see cues.h
+};
+
+//after the header the data is a list of runs, each starts with a byte holding the type
+//in the high two bits and the number of leds minus one in the low six bits
+#define NZS_MAXRUN 64
+
+enum NzsRun
+{
+  NzsLiteral = 0x00, //followed by the data of every led
+  NzsRepeat  = 0x40, //followed by the data all leds are set to
+  NzsSkip    = 0x80, //the leds keep their value from the previous frame
+};
+
+struct SArtAddress
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     NetSwitch;
+  uint8_t     BindIndex;
+  uint8_t     ShortName[18];
+  uint8_t     LongName[64];
+  uint8_t     SwIn[4];
+  uint8_t     SwOut[4];
+  uint8_t     SubSwitch;
+  uint8_t     SwVideo;
+  uint8_t     Command;
+} __attribute__((packed));
+
+struct SArtDiagData
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     Filler1;
+  uint8_t     Priority;
+  uint8_t     Filler2;
+  uint8_t     Filler3;
+  uint8_t     LengthHi;
+  uint8_t     Length;
+  uint8_t     Data[512]; //null terminated text
+} __attribute__((packed));
+
+struct SArtCommand
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     EstaManHi;
+  uint8_t     EstaManLo;
+  uint8_t     LengthHi;
+  uint8_t     Length;
+  uint8_t     Data[512]; //"keyword=value&" pairs
+} __attribute__((packed));
+
+enum TimeCodeType
+{
+  TcFilm  = 0, //24 fps
+  TcEbu   = 1, //25 fps
+  TcDf    = 2, //29.97 fps
+  TcSmpte = 3, //30 fps
+};
+
+struct SArtTimeCode
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     Filler1;
+  uint8_t     Filler2;
+  uint8_t     Frames;
+  uint8_t     Seconds;
+  uint8_t     Minutes;
+  uint8_t     Hours;
+  uint8_t     Type;
+} __attribute__((packed));
+
+enum TriggerKey
+{
+  KeyAscii = 0, //The SubKey field contains an ASCII character which the receiving device should process as if it were a keyboard press.
+  KeyMacro = 1, //The SubKey field contains the number of a Macro which the receiving device should execute.
+  KeySoft  = 2, //The SubKey field contains a soft-key number which the receiving device should process as if it were a soft-key keyboard press.
+  KeyShow  = 3, //The SubKey field contains the number of a Show which the receiving device should run.
+};
+
+struct SArtTrigger
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     Filler1;
+  uint8_t     Filler2;
+  uint8_t     OemHi;
+  uint8_t     OemLo;
+  uint8_t     Key;
+  uint8_t     SubKey;
+  uint8_t     Data[512];
+} __attribute__((packed));
+
+struct SArtSync
+{
+  uint8_t     ID[8];
+  uint16_t    OpCode;
+  uint8_t     ProtVerHi;
+  uint8_t     ProtVerLow;
+  uint8_t     Aux1;
+  uint8_t     Aux2;
+} __attribute__((packed));
+
+//a controller sending ArtDmx to this node, two of them can be merged
+struct SArtNetSource
+{
+  uint8_t  ip[4];
+  uint32_t time;
+  bool     active;
+  uint8_t  sequence[NUM_UNIVERSES]; //last ArtDmx sequence number per universe, 0 if not used
+};
+
+#define NUM_SOURCES 2
+
+//a source that hasn't sent ArtDmx for this many milliseconds is dropped
+#define MERGETIMEOUT 10000
+
+//an ArtDmx sequence number at most this much behind the last one is a late packet and is discarded,
+//if it is further behind the controller is assumed to have restarted
+#define SEQUENCEWINDOW 32
+
 class CController;
 
 class CArtNet
@@ -244,14 +506,35 @@ class CArtNet
     void     Initialize();
     void     Process(uint32_t now);
     void     SetPortAddress(uint16_t portaddress) { m_portaddress = portaddress; }
-    void     SetPollReplyDelay(uint16_t delay)    { m_sendpollreplydelay = delay;    }
+    uint16_t PortAddress()                        { return m_portaddress;       }
     void     HandlePacket(byte ip[4], uint16_t port, uint8_t* data, uint16_t len);
+    uint16_t ClassifyPacket(const uint8_t* data, uint16_t peeklen, uint16_t len);
+    bool     IsMerging()                          { return m_merging;  }
+    bool     MergeLtp()                           { return m_mergeltp; }
+    void     SetDhcpPending(bool pending)         { m_dhcppending = pending; }
 
   private:
     void HandlePoll(byte ip[4], uint16_t port, uint8_t* data, uint16_t len);
-    void HandleOutput(uint8_t* data, uint16_t len);
+    void HandleOutput(byte ip[4], uint8_t* data, uint16_t len);
+    void HandleNzs(byte ip[4], uint8_t* data, uint16_t len);
+    void HandleAddress(uint8_t* data, uint16_t len);
+    void HandleSync(uint8_t* data, uint16_t len);
+    void HandleCommand(uint8_t* data, uint16_t len);
+    void HandleTrigger(uint8_t* data, uint16_t len);
+    void HandleTimeCode(uint8_t* data, uint16_t len);
+
+    uint16_t UniverseIndex(uint16_t portaddress);
+
+    int8_t FindSource(byte ip[4], uint32_t now);
+#if HWFILTER
+    void   SetFilter(uint8_t filter);
+#endif
+    bool   CheckSequence(SArtNetSource& source, uint8_t universe, uint8_t sequence);
 
-    void SendPollReply(uint8_t* ip = NULL);
+    void     SchedulePollReply(uint8_t* ip = NULL);
+    void     SendPollReply(uint8_t* ip = NULL);
+    void     SendDiagData();
+    uint16_t Random();
 
     CController& m_controller;
     uint8_t*     m_transmitbuf;
@@ -260,7 +543,24 @@ class CArtNet
     uint16_t     m_portaddress;
     bool         m_sendpollreply;
     uint32_t     m_sendpollreplytime;
-    uint16_t     m_sendpollreplydelay;
+    bool         m_sendunicastreply;
+    uint32_t     m_sendunicastreplytime;
+    uint8_t      m_unicastreplyip[4];
+    uint16_t     m_random;
+    bool         m_senddiag;
+    uint8_t      m_diagip[4]; //broadcast address, unless the poller asked for unicast diagnostics
+    SArtNetSource m_sources[NUM_SOURCES];
+    bool         m_merging;
+    bool         m_mergeltp;
+    bool         m_cancelmerge;
+    uint8_t      m_filter;
+    uint32_t     m_dmxtime;
+    uint32_t     m_broadcastdmxtime; //when ArtDmx for this node was last received as broadcast
+    bool         m_dhcppending;      //DHCP is confirming a stored lease
+    uint16_t     m_pollreplycount;
+    uint32_t     m_packetslost;       //ArtDmx packets missing from the sequence
+    uint32_t     m_packetsreordered;  //ArtDmx packets discarded because a newer one was already received
+    uint32_t     m_packetsduplicated; //ArtDmx packets discarded because they were already received
 };
 
 #endif //ARTNET_H
@@ -1,63 +1,115 @@
-#include <Arduino.h>
-#include <avr/wdt.h>
-#include <EtherCard.h>
+#include "hal.h"
 #include "controller.h"
+#include "gamma.h"
 #include "debugprint.h"
 
-byte Ethernet::buffer[600];
-
 #if STATIC
 static byte myip[] = { 192,168,1,200 };
 static byte gwip[] = { 192,168,1,1 };
 #endif
 
-extern void Transmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport);
+static SRetained g_retained HALNOINIT;
+
+#ifdef __AVR__
+static_assert(sizeof(SRetained) + sizeof(CController) + HALBUFFERSIZE + RAMRESERVE <= RAMEND + 1 - RAMSTART,
+              "the led buffers don't fit in RAM, use fewer universes, a smaller PALETTESIZE, or leave out ARTSYNC, INTERPOLATE or SACN");
+#endif
 
-CController::CController() : m_artnet(*this, Ethernet::buffer + UDP_DATA_P, ether.myip, ether.mymac)
+CController::CController() : m_artnet(*this, HalNetTransmitBuffer(), HalNetIp(), HalNetMac())
+#if SACN
+  , m_sacn(*this, HalNetIp())
+#endif
 {
+#if NUM_LEDBUFFERS > 0
+  m_leds = g_retained.ledbuffers[0];
+  m_backleds = g_retained.ledbuffers[ARTSYNC ? 1 : 0];
+  m_prevleds = g_retained.ledbuffers[NUM_LEDBUFFERS - 1];
+#else
+  //without a led buffer, the boot frame is put in the transmit buffer, which is big enough for one universe
+  m_leds = m_backleds = m_prevleds = (CLed*)HalNetTransmitBuffer();
+#endif
+  m_merging = false;
+  m_synced = false;
+  m_syncpending = false;
+  m_synctime = 0;
+  m_universesreceived = 0;
+  m_frametime = 0;
+  m_framepending = false;
+  m_framependingtime = 0;
+  m_framesshown = 0;
+  m_framescoalesced = 0;
+  m_framesdropped = 0;
+  m_dmxtime = 0;
+  m_gamma = 0;
+  m_brightness = 255;
+  m_order[0] = 0;
+  m_order[1] = 1;
+  m_order[2] = 2;
+  m_plaincopy = true;
+  m_looptime = 0;
+  m_receivetime = 0;
+  m_parsetime = 0;
+  m_copytime = 0;
+  m_packets = 0;
+  m_fps = 0;
+  m_fpstime = 0;
+  m_fpsframes = 0;
+  m_cue = -1;
+  m_cuetime = 0;
+  m_cueaddress = 0;
+  m_timecode = 0;
+  m_timecodefps = 0;
+  m_timecodetime = 0;
+  m_playframe = 0;
+  m_cueblockstart = 0;
+  m_cueblocklen = 0;
+  m_cueblockwritten = 0;
+  m_fading = false;
+  m_fadestart = 0;
+  m_frameinterval = 0;
+  SetMaxFps(MAXFPS);
+#if PALETTE
+  m_palette = g_retained.palette;
+#endif
 }
 
-#define DATAPIN 1
-#define CLOCKPIN 4
-#define SELECTPIN 6
-#define ETHERRESETPIN 9
-
 void CController::Initialize()
 {
-  //make the pixel/strip pin an input, and enable the internal pullup
-  pinMode(SELECTPIN, INPUT);
-  digitalWrite(SELECTPIN, HIGH);
-  //let the pin rise if the jumper is open
-  delay(10);
-
   //add led chip based on jumper position
-  if (digitalRead(SELECTPIN))
+  //in palette mode the leds are only shown with HalLedsShowPalette(), which doesn't need them registered
+  LedType ledtype = HalLedsInitialize(PALETTE ? NULL : (CRGB*)m_leds, NUM_LEDS);
+
+  if (RestoreFrame())
   {
-    LEDS.addLeds<WS2812B, DATAPIN, GRB>(m_leds, NUM_LEDS); //led strip
-    memset(m_leds, 0x10, sizeof(m_leds)); //led strip can't handle full white
+    DBGPRINT("Showing the frame from before the reset\n");
   }
   else
   {
-    LEDS.addLeds<WS2801, DATAPIN, CLOCKPIN, BRG>(m_leds, NUM_LEDS); //led pixel
-    memset(m_leds, 0xFF, sizeof(m_leds));
+#if PALETTE
+    //start with a grey ramp, so the boot frame below looks the same as without the palette
+    for (uint16_t i = 0; i < PALETTESIZE; i++)
+      m_palette[i].r = m_palette[i].g = m_palette[i].b = i * 255 / (PALETTESIZE - 1);
+#endif
+
+    //make all leds white
+    if (ledtype == LedStrip)
+      memset(m_leds, 0x10 * PALETTESIZE / 256, sizeof(CLed) * NUM_LEDS); //led strip can't handle full white
+    else
+      memset(m_leds, PALETTESIZE - 1, sizeof(CLed) * NUM_LEDS);
   }
 
-  //make all leds white
-  LEDS.show();
+#if PALETTE
+  HalLedsShowPalette(m_leds, m_palette, PALETTESIZE, NUM_LEDS);
+#else
+  HalLedsShow(m_leds, NUM_LEDS);
+#endif
 
   //init the led timestamp
   m_ledshowtime = millis();
 
-  //make the reset pin low for 100 ms, to reset the ENC28J60
-  pinMode(ETHERRESETPIN, OUTPUT);
-  digitalWrite(ETHERRESETPIN, LOW);
-  delay(100);
-  digitalWrite(ETHERRESETPIN, HIGH);
-  delay(100);
-
-  wdt_reset();
+  HalWatchdogReset();
   uint8_t mac[] = { 0x70,0x69,0x69,0x2D,0x30,0x31 };
-  if (ether.begin(sizeof(Ethernet::buffer), mac))
+  if (HalNetBegin(mac))
   {
     DBGPRINT("Ethernet controller set up\n");
   }
@@ -67,45 +119,57 @@ void CController::Initialize()
     for(;;); //wait for the watchdog timer reset
   }
 
-  //delay for the ethernet switch to bring up stuff
-  wdt_reset();
-  delay(5000);
-  wdt_reset();
-
   //enable broadcast for dhcp and art-net
-  ether.enableBroadcast();
+  HalNetEnableBroadcast();
 
 #if STATIC
-  ether.staticSetup(myip, gwip);
+  HalNetStaticSetup(myip, gwip);
+  SetPortAddressFromIp();
 #else
-  DBGPRINT("Requesting ip address using DHCP\n");
-
-  //try dhcp 5 times before doing a watchdog timer reset
-  for (uint8_t i = 0; i < 5; i++)
+  //after a reset the node comes up on its last lease at once, DHCP confirms or renews it in the background,
+  //only without a stored lease does it wait for DHCP
+  if (UseStoredLease())
   {
-    if (ether.dhcpSetup())
-    {
-      DBGPRINT("DHCP succeeded\n");
-      break;
-    }
-    else
+    DBGPRINT("Using the stored lease, renewing it in the background\n");
+    m_artnet.SetDhcpPending(true);
+  }
+  else
+  {
+    WaitForLink();
+    DBGPRINT("Requesting ip address using DHCP\n");
+
+    //try dhcp 5 times before doing a watchdog timer reset
+    for (uint8_t i = 0; i < 5; i++)
     {
-      DBGPRINT("DHCP failed\n");
-      if (i == 4)
-        for(;;); //wait for the watchdog timer reset
+      if (HalNetDhcpSetup())
+      {
+        DBGPRINT("DHCP succeeded\n");
+        break;
+      }
+      else
+      {
+        DBGPRINT("DHCP failed\n");
+        if (i == 4)
+          for(;;); //wait for the watchdog timer reset
+      }
     }
+
+    SetPortAddressFromIp();
+    StoreLease();
   }
 #endif
 
-  DBGPRINT("IP: %i.%i.%i.%i\n", ether.myip[0], ether.myip[1], ether.myip[2], ether.myip[3]);
-  DBGPRINT("GW: %i.%i.%i.%i\n", ether.gwip[0], ether.gwip[1], ether.gwip[2], ether.gwip[3]);
-  DBGPRINT("DNS: %i.%i.%i.%i\n", ether.dnsip[0], ether.dnsip[1], ether.dnsip[2], ether.dnsip[3]);
-  DBGPRINT("MASK: %i.%i.%i.%i\n", ether.mymask[0], ether.mymask[1], ether.mymask[2], ether.mymask[3]);
+  DBGPRINT("IP: %i.%i.%i.%i\n", HalNetIp()[0], HalNetIp()[1], HalNetIp()[2], HalNetIp()[3]);
+  DBGPRINT("GW: %i.%i.%i.%i\n", HalNetGateway()[0], HalNetGateway()[1], HalNetGateway()[2], HalNetGateway()[3]);
+  DBGPRINT("DNS: %i.%i.%i.%i\n", HalNetDns()[0], HalNetDns()[1], HalNetDns()[2], HalNetDns()[3]);
+  DBGPRINT("MASK: %i.%i.%i.%i\n", HalNetMask()[0], HalNetMask()[1], HalNetMask()[2], HalNetMask()[3]);
 
-  SetPortAddressFromIp();
-  EtherCard::dhcp_renewed = false;
+  HalNetClearDhcpRenewed();
   m_artnet.Initialize();
-  wdt_reset();
+#if SACN
+  m_sacn.Initialize(m_artnet.PortAddress());
+#endif
+  HalWatchdogReset();
 
   //init last valid data timestamp
   m_validdatatime = millis();
@@ -118,78 +182,1083 @@ void CController::SetPortAddressFromIp()
   uint32_t mask = 0;
   for (uint8_t i = 0; i < 4; i++)
   {
-    address |= (uint32_t)ether.myip[i] << (3 - i) * 8;
-    mask |= (uint32_t)ether.mymask[i] << (3 - i) * 8;
+    address |= (uint32_t)HalNetIp()[i] << (3 - i) * 8;
+    mask |= (uint32_t)HalNetMask()[i] << (3 - i) * 8;
   }
 
   //do a bitwise and with the subnetmask to get the host address
   uint32_t hostaddress = address & ~mask;
   //subtract one from the host address, take the 15 least significant bits, and use it as the art-net portaddress
-  uint16_t portaddress = (hostaddress - 1) & 0x3FFF;
+  //every controller outputs NUM_UNIVERSES universes, so the port address is multiplied by that,
+  //to make sequentially numbered controllers use consecutive universes
+  uint16_t portaddress = ((hostaddress - 1) * NUM_UNIVERSES) & 0x3FFF;
 
   m_artnet.SetPortAddress(portaddress);
-  //set the ArtPollReply delay so that if a lot of these controllers are on the network,
-  //and their ip addresses are numbered sequentually,
-  //a controller will send ArtPollReply every 2 milliseconds
-  //this prevents the ENC28J60 buffer filling up with a shitload of ArtPollReply broadcasts
-  uint16_t delay = (hostaddress % 1000) * 2;
-  m_artnet.SetPollReplyDelay(delay);
 
   DBGPRINT("address:%lu\n", address);
   DBGPRINT("mask:%lu\n", mask);
   DBGPRINT("hostaddress:%lu\n", hostaddress);
   DBGPRINT("portaddress:%u\n", portaddress);
   DBGPRINT("net:%i subnet:%i universe:%i\n", (portaddress >> 8) & 0xFF, (portaddress >> 4) & 0xF, portaddress & 0xF);
-  DBGPRINT("artpollreply delay: %i\n", delay);
+  DBGPRINT("universes:%i\n", NUM_UNIVERSES);
+}
+
+//takes over the frame and settings kept in g_retained over a watchdog reset,
+//returns false after power up, or when the leds weren't shown since they last changed
+bool CController::RestoreFrame()
+{
+#if NUM_LEDBUFFERS > 0
+  if (g_retained.magic != RETAINMAGIC || g_retained.front >= NUM_LEDBUFFERS ||
+      g_retained.checksum != RetainedChecksum())
+    return false;
+
+  m_leds = g_retained.ledbuffers[g_retained.front];
+#if ARTSYNC
+  m_backleds = g_retained.ledbuffers[g_retained.front ^ 1];
+#endif
+  m_gamma = min(g_retained.gamma, NUM_GAMMATABLES - 1);
+  m_brightness = g_retained.brightness;
+  memcpy(m_order, g_retained.order, sizeof(m_order));
+  UpdatePlainCopy();
+  return true;
+#else
+  return false;
+#endif
+}
+
+//stores what's needed to show the leds again after a watchdog reset, called whenever they're shown
+void CController::RetainFrame()
+{
+#if NUM_LEDBUFFERS > 0
+  g_retained.magic = RETAINMAGIC;
+  g_retained.front = (m_leds - g_retained.ledbuffers[0]) / NUM_LEDS;
+  g_retained.gamma = m_gamma;
+  g_retained.brightness = m_brightness;
+  memcpy(g_retained.order, m_order, sizeof(g_retained.order));
+  g_retained.checksum = RetainedChecksum();
+#endif
+}
+
+//Fletcher style checksum without the modulo, so it's cheap enough to run for every shown frame
+uint16_t CController::RetainedChecksum()
+{
+  uint8_t sum1 = NUM_LEDS & 0xFF;
+  uint8_t sum2 = NUM_LEDS >> 8;
+
+#if NUM_LEDBUFFERS > 0
+  const uint8_t* data = (const uint8_t*)g_retained.ledbuffers[g_retained.front % NUM_LEDBUFFERS];
+  for (uint16_t i = 0; i < sizeof(CLed) * NUM_LEDS; i++)
+  {
+    sum1 += data[i];
+    sum2 += sum1;
+  }
+#endif
+
+#if PALETTE
+  for (uint16_t i = 0; i < sizeof(g_retained.palette); i++)
+  {
+    sum1 += ((const uint8_t*)g_retained.palette)[i];
+    sum2 += sum1;
+  }
+#endif
+
+  //the settings, from front up to the checksum
+  const uint8_t* settings = &g_retained.front;
+  for (uint8_t i = 0; i < (const uint8_t*)&g_retained.checksum - settings; i++)
+  {
+    sum1 += settings[i];
+    sum2 += sum1;
+  }
+
+  return ((uint16_t)sum2 << 8) | sum1;
+}
+
+//waits up to 5 seconds for the ethernet switch to bring up the link
+void CController::WaitForLink()
+{
+  uint32_t start = millis();
+  while (!HalNetLinkUp() && millis() - start < 5000)
+    HalWatchdogReset();
+
+  DBGPRINT("Link %s after %lu ms\n", HalNetLinkUp() ? "up" : "down", millis() - start);
+}
+
+//sets up the network with the lease stored by StoreLease(), returns false if there is none
+bool CController::UseStoredLease()
+{
+  SSettings settings;
+  HalEepromRead(SETTINGSADDRESS, (uint8_t*)&settings, sizeof(settings));
+  if ((((uint16_t)settings.MagicHi << 8) | settings.MagicLo) != SETTINGSMAGIC)
+    return false;
+
+  HalNetLeaseSetup(settings.Ip, settings.Mask, settings.Gateway);
+  m_artnet.SetPortAddress(((uint16_t)settings.PortAddressHi << 8) | settings.PortAddressLo);
+  return true;
+}
+
+//stores the lease and port address in the EEPROM, only bytes that changed are written
+void CController::StoreLease()
+{
+  SSettings settings;
+  settings.MagicHi = SETTINGSMAGIC >> 8;
+  settings.MagicLo = SETTINGSMAGIC & 0xFF;
+  memcpy(settings.Ip, HalNetIp(), sizeof(settings.Ip));
+  memcpy(settings.Mask, HalNetMask(), sizeof(settings.Mask));
+  memcpy(settings.Gateway, HalNetGateway(), sizeof(settings.Gateway));
+  settings.PortAddressHi = m_artnet.PortAddress() >> 8;
+  settings.PortAddressLo = m_artnet.PortAddress() & 0xFF;
+  HalEepromWrite(SETTINGSADDRESS, (uint8_t*)&settings, sizeof(settings));
+}
+
+void CController::Poll()
+{
+  uint32_t start = micros();
+  m_parsetime = 0;
+  if (HalNetPoll())
+    m_receivetime = micros();
+
+  //only count polls that handled a packet, the time spent handling it is counted separately
+  if (m_parsetime)
+    m_recvstats.Add(micros() - start - m_parsetime);
 }
 
 void CController::Process()
 {
   uint32_t now = millis();
 
-  //if valid art-net data has been received in the last minute,
+  uint32_t loopstart = micros();
+  if (m_looptime)
+    m_loopstats.Add(loopstart - m_looptime);
+  m_looptime = loopstart;
+
+  if (now - m_fpstime >= 1000)
+  {
+    m_fps = m_framesshown - m_fpsframes;
+    m_fpsframes = m_framesshown;
+    m_fpstime = now;
+  }
+
+  //if valid art-net data has been received in the last minute, or an effect is running,
   //reset the watchdog timer
-  if (now - m_validdatatime < 60000)
-    wdt_reset();
+  if (now - m_validdatatime < 60000 || m_effects.Active())
+    HalWatchdogReset();
 
   m_artnet.Process(now);
+#if SACN
+  m_sacn.Process(now);
+#endif
 
-  //transmit data to the leds at least once per second, to make sure they stay on
-  if (now - m_ledshowtime >= 1000)
+  //show the pending frame once the frame period has passed,
+  //unless the controller is halfway sending the universes of the next frame
+  if (m_framepending && m_universesreceived == 0 && now - m_frametime >= m_frameperiod)
   {
-    LEDS.show();
-    m_ledshowtime = now;
+    uint32_t due = m_frametime + m_frameperiod;
+    if ((int32_t)(m_framependingtime - due) > 0)
+      due = m_framependingtime;
+    //the frame period counts from when the frame was due, so waiting for the traffic doesn't lower the frame rate
+    if (ReceiveIdle(due, now))
+    {
+      ShowFrame(now);
+      m_frametime = due;
+    }
   }
 
-  if (EtherCard::dhcp_renewed)
+  //render the next frame of the effect started with ArtTrigger
+  if (m_effects.Active() && now - m_ledshowtime >= 1000 / EFFECTFPS && ReceiveIdle(m_ledshowtime + 1000 / EFFECTFPS, now))
+    ShowEffect(now);
+
+  //an EEPROM write takes 3.3 ms, so the staged cue data is written a byte per loop
+  if (m_cueblockwritten < m_cueblocklen)
+    WriteCueData();
+
+  PlayCues(now);
+
+#if INTERPOLATE
+  //render the next step of the fade to the current frame
+  if (m_fading && now - m_ledshowtime >= 1000 / INTERPOLATEFPS && ReceiveIdle(m_ledshowtime + 1000 / INTERPOLATEFPS, now))
+    ShowFade(now);
+#endif
+
+  //transmit data to the leds at least once per second, to make sure they stay on,
+  //it waits for a gap in the traffic like the frames, see RECEIVEIDLETIME
+  if (LED_KEEPALIVE && now - m_ledshowtime >= 1000 && ReceiveIdle(m_ledshowtime + 1000, now))
+    ShowLeds(now);
+
+  if (HalNetDhcpRenewed())
   {
     //possibly new ip address, reset port address
     SetPortAddressFromIp();
+    StoreLease();
+    m_artnet.SetDhcpPending(false);
     m_artnet.Initialize();
-    EtherCard::dhcp_renewed = false;
+#if SACN
+    m_sacn.Initialize(m_artnet.PortAddress());
+#endif
+    HalNetClearDhcpRenewed();
   }
 }
 
+uint16_t CController::ClassifyPacket(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len)
+{
+#if SACN
+  if (port == SACNPORT)
+    return m_sacn.ClassifyPacket(data, peeklen, len);
+#endif
+
+  return m_artnet.ClassifyPacket(data, peeklen, len);
+}
+
 void CController::HandlePacket(byte ip[4], uint16_t port, uint8_t* data, uint16_t len)
 {
-  m_artnet.HandlePacket(ip, port, data, len);
+  uint32_t start = micros();
+  m_copytime = 0;
+#if SACN
+  if (port == SACNPORT)
+    m_sacn.HandlePacket(data, len);
+  else
+#endif
+    m_artnet.HandlePacket(ip, port, data, len);
+
+  //at least 1 so Poll() knows a packet was handled
+  m_parsetime = max(micros() - start, (uint32_t)1);
+  m_parsestats.Add(m_parsetime - m_copytime);
+  m_packets++;
 }
 
 void CController::Transmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport)
 {
-  ::Transmit(data, size, sourceport, destip, destport);
+  HalNetTransmit(data, size, sourceport, destip, destport);
 }
 
-void CController::OnDmxData(uint8_t* data, uint16_t channels)
+void CController::OnDmxData(uint8_t source, uint8_t universe, uint8_t* data, uint16_t channels)
 {
-  memcpy(m_leds, data, min(channels, sizeof(m_leds)));
-  LEDS.show();
-  m_ledshowtime = millis();
+  uint32_t start = micros();
+  m_dmxtime = millis();
+  HandleDmxData(source, universe, data, channels);
+  m_copytime = micros() - start;
+  m_copystats.Add(m_copytime);
+}
+
+void CController::HandleDmxData(uint8_t source, uint8_t universe, uint8_t* data, uint16_t channels)
+{
+  uint32_t now = millis();
+
+  //streamed data takes over from the effect
+  m_effects.Stop();
+
+#if ZEROCOPY
+  //show the leds straight from the ethernet buffer,
+  //no packet can be received into it until this function returns
+  //the data can't be kept until the frame is due, so frames arriving too fast are dropped
+  if (now - m_ledshowtime < m_frameperiod)
+  {
+    m_framesdropped++;
+    return;
+  }
+
+  channels = min(channels, sizeof(CRGB) * NUM_LEDS);
+  CopyDmxData(data, data, channels);
+  uint32_t start = micros();
+  HalLedsShow((CRGB*)data, channels / sizeof(CRGB));
+  m_showstats.Add(micros() - start);
+  m_ledshowtime = now;
+  m_framesshown++;
+#if ZEROCOPY_KEEPALIVE
+  memcpy(m_leds, data, channels);
+  RetainFrame();
+#endif
+  return;
+#endif
+
+  CheckSyncTimeout(now);
+
+#if MERGE
+  bool merging = m_artnet.IsMerging();
+#if SACN
+  merging = merging || m_sacn.IsMerging();
+#endif
+  if (merging && !m_merging)
+  {
+    //the leds show the data of the source that was already sending, start both sources from that
+    for (uint8_t i = 0; i < NUM_SOURCES; i++)
+      memcpy(m_sourceleds[i], m_leds, sizeof(CLed) * NUM_LEDS);
+
+    //ArtSync is ignored while merging
+    m_synced = false;
+    m_syncpending = false;
+  }
+  m_merging = merging;
+#endif
+
+  uint16_t offset = universe * LEDS_PER_UNIVERSE;
+  channels = min(channels, sizeof(CLed) * LEDS_PER_UNIVERSE);
+
+  if (m_synced)
+  {
+    //keep the data in the back buffer until the next ArtSync
+    CopyLedData(m_backleds + offset, data, channels);
+    m_syncpending = true;
+    return;
+  }
+
+  //if this universe was already received for the current frame,
+  //the controller started sending the next frame without sending all universes,
+  //show what was received so far
+  uint16_t universebit = 1U << universe;
+  if (m_universesreceived & universebit)
+  {
+    m_universesreceived = 0;
+    QueueFrame(now);
+  }
+
+  FlushFrame(now);
+
+#if INTERPOLATE
+  StartFade(now);
+#endif
+
+  if (m_merging)
+  {
+    //gamma and brightness don't change which value is highest, so the corrected values are merged
+    CopyDmxData(data, data, channels);
+    MergeDmxData(source, offset, data, channels);
+  }
+  else
+  {
+    CopyLedData(m_leds + offset, data, channels);
+  }
+  m_universesreceived |= universebit;
+
+  //show the leds once all universes of the frame have been received
+  if (m_universesreceived == (uint16_t)((1UL << NUM_UNIVERSES) - 1))
+  {
+    m_universesreceived = 0;
+    QueueFrame(now);
+  }
+}
+
+void CController::OnNzsData(uint8_t universe, uint16_t start, uint8_t flags, const uint8_t* data, uint16_t len)
+{
+  uint32_t begin = micros();
+  m_dmxtime = millis();
+  HandleNzsData(universe, start, flags, data, len);
+  m_copytime = micros() - begin;
+  m_copystats.Add(m_copytime);
+}
+
+void CController::HandleNzsData(uint8_t universe, uint16_t start, uint8_t flags, const uint8_t* data, uint16_t len)
+{
+#if NUM_LEDBUFFERS > 0
+  uint32_t now = millis();
+
+  //the runs are decoded straight into the leds, the data of two sources can't be merged that way
+  if (m_merging)
+  {
+    DBGPRINT("Ignoring ArtNzs while merging\n");
+    return;
+  }
+
+  CheckSyncTimeout(now);
+
+  if (flags & NzsCues)
+  {
+    StageCueData(start, data, len);
+    return;
+  }
+
+  if (flags & NzsPalette)
+  {
+#if PALETTE
+    //the new colors show up on the leds straight away, or with the next ArtSync
+    SetPaletteData(start, data, len);
+    if ((flags & NzsLastPacket) && !m_synced)
+      QueueFrame(now);
+#else
+    DBGPRINT("Ignoring ArtNzs palette, PALETTE is not enabled\n");
+#endif
+    return;
+  }
+
+  m_effects.Stop();
+
+  uint16_t offset = universe * LEDS_PER_UNIVERSE + start;
+  if (offset >= NUM_LEDS)
+  {
+    DBGPRINT("Received ArtNzs starting at led %u, past the last led\n", offset);
+    return;
+  }
+
+  CLed* leds = m_leds;
+  if (m_synced)
+  {
+    //skipped leds keep the last frame, the back buffer still holds the one before it
+    if (!m_syncpending)
+      memcpy(m_backleds, m_leds, sizeof(CLed) * NUM_LEDS);
+    leds = m_backleds;
+  }
+  else
+  {
+    FlushFrame(now);
+#if INTERPOLATE
+    if (start == 0)
+      StartFade(now);
+#endif
+  }
+
+  DecodeNzsData(leds + offset, NUM_LEDS - offset, data, len);
+
+  if (m_synced)
+  {
+    m_syncpending = true;
+  }
+  else if (flags & NzsLastPacket)
+  {
+    m_universesreceived = 0;
+    QueueFrame(now);
+  }
+#else
+  DBGPRINT("Ignoring ArtNzs, ZEROCOPY has no led buffer to decode it into\n");
+#endif
+}
+
+//decodes the runs of ArtNzs led data into leds, which hold the previous frame,
+//leds past numleds and a run cut off by the end of the data are left out
+void CController::DecodeNzsData(CLed* leds, uint16_t numleds, const uint8_t* data, uint16_t len)
+{
+  while (len > 0 && numleds > 0)
+  {
+    uint8_t  run = *data++;
+    uint8_t  type = run & ~(NZS_MAXRUN - 1);
+    uint16_t runleds = (run & (NZS_MAXRUN - 1)) + 1;
+    uint16_t count = min(runleds, numleds);
+    len--;
+
+    if (type == NzsLiteral)
+    {
+      uint16_t size = min(runleds * sizeof(CLed), len);
+      CopyLedData(leds, data, min(count * sizeof(CLed), size));
+      data += size;
+      len -= size;
+    }
+    else if (type == NzsRepeat)
+    {
+      if (len < sizeof(CLed))
+        break;
+
+      CopyLedData(leds, data, sizeof(CLed));
+      for (uint16_t i = 1; i < count; i++)
+        leds[i] = leds[0];
+
+      data += sizeof(CLed);
+      len -= sizeof(CLed);
+    }
+    else if (type != NzsSkip)
+    {
+      DBGPRINT("Invalid ArtNzs run type %u\n", type);
+      break;
+    }
+
+    leds += count;
+    numleds -= count;
+  }
+}
+
+//keeps part of the cue table until Process() has written it to the EEPROM,
+//writing it here would stop the network polling for 3.3 ms per byte, playback starts again from the first cue
+void CController::StageCueData(uint16_t start, const uint8_t* data, uint16_t len)
+{
+  if (m_cueblockwritten < m_cueblocklen)
+  {
+    DBGPRINT("Dropping cue data at %u, still writing the previous block\n", start);
+    return;
+  }
+
+  if (start >= CUETABLESIZE)
+    return;
+
+  len = min(len, CUETABLESIZE - start);
+  if (len > CUEBLOCKSIZE)
+  {
+    DBGPRINT("Dropping %u bytes of cue data at %u, blocks are at most %u bytes\n", len, start, CUEBLOCKSIZE);
+    return;
+  }
+
+  DBGPRINT("Writing %u bytes of the cue table at %u\n", len, start);
+  memcpy(m_cueblock, data, len);
+  m_cueblockstart = start;
+  m_cueblocklen = len;
+  m_cueblockwritten = 0;
+  m_cue = -1;
+}
+
+//writes the next byte of the staged cue data to the EEPROM
+void CController::WriteCueData()
+{
+  HalEepromWrite(CUEADDRESS + m_cueblockstart + m_cueblockwritten, m_cueblock + m_cueblockwritten, 1);
+  m_cueblockwritten++;
+}
+
+#if PALETTE
+//sets the palette colors from start, applying the channel order, gamma and brightness
+void CController::SetPaletteData(uint16_t start, const uint8_t* data, uint16_t len)
+{
+  if (start >= PALETTESIZE)
+    return;
+
+  len = min(len, sizeof(CRGB) * (PALETTESIZE - start));
+  CopyDmxData((uint8_t*)(m_palette + start), data, len);
+}
+#endif
+
+//decodes the cues after the last applied one, up to the last one at or before time into the leds,
+//returns true if any cue was applied
+bool CController::ApplyCues(uint32_t time)
+{
+  //the table is only partly written
+  if (m_cueblockwritten < m_cueblocklen)
+    return false;
+
+  SCueTable table;
+  HalEepromRead(CUEADDRESS, (uint8_t*)&table, sizeof(table));
+  if ((((uint16_t)table.MagicHi << 8) | table.MagicLo) != CUEMAGIC)
+    return false;
+
+  int16_t  cue = m_cue + 1;
+  uint16_t address = cue == 0 ? sizeof(SCueTable) : m_cueaddress;
+  bool     applied = false;
+
+  while (cue < table.NumCues && address + sizeof(SCue) <= CUETABLESIZE)
+  {
+    SCue header;
+    HalEepromRead(CUEADDRESS + address, (uint8_t*)&header, sizeof(header));
+    uint32_t cuetime = CueTime(header.Hours, header.Minutes, header.Seconds, header.Frames);
+    if (cuetime > time)
+      break;
+
+    uint16_t start = ((uint16_t)header.StartHi << 8) | header.StartLo;
+    uint16_t length = ((uint16_t)header.LengthHi << 8) | header.LengthLo;
+    address += sizeof(SCue);
+    if (length > CUETABLESIZE - address)
+    {
+      DBGPRINT("Cue %i runs past the end of the cue table\n", cue);
+      break;
+    }
+
+#if INTERPOLATE
+    //the fade to the new cue starts from what the leds show now
+    if (!applied)
+      StartFade(millis());
+#endif
+
+    if (start < NUM_LEDS)
+      DecodeCueData(m_leds + start, NUM_LEDS - start, CUEADDRESS + address, length);
+
+    DBGPRINT("Applied cue %i at %02u:%02u:%02u:%02u\n", cue, header.Hours, header.Minutes, header.Seconds, header.Frames);
+
+    address += length;
+    m_cue = cue++;
+    m_cuetime = cuetime;
+    m_cueaddress = address;
+    applied = true;
+  }
+
+  return applied;
+}
+
+//the same as DecodeNzsData(), with the runs read from the EEPROM,
+//the led data is read straight into the leds and corrected in place
+void CController::DecodeCueData(CLed* leds, uint16_t numleds, uint16_t address, uint16_t len)
+{
+  while (len > 0 && numleds > 0)
+  {
+    uint8_t  run;
+    HalEepromRead(address++, &run, 1);
+    uint8_t  type = run & ~(NZS_MAXRUN - 1);
+    uint16_t runleds = (run & (NZS_MAXRUN - 1)) + 1;
+    uint16_t count = min(runleds, numleds);
+    len--;
+
+    if (type == NzsLiteral)
+    {
+      uint16_t size = min(runleds * sizeof(CLed), len);
+      uint16_t used = min(count * sizeof(CLed), size);
+      HalEepromRead(address, (uint8_t*)leds, used);
+      CopyLedData(leds, (uint8_t*)leds, used);
+      address += size;
+      len -= size;
+    }
+    else if (type == NzsRepeat)
+    {
+      if (len < sizeof(CLed))
+        break;
+
+      HalEepromRead(address, (uint8_t*)leds, sizeof(CLed));
+      CopyLedData(leds, (uint8_t*)leds, sizeof(CLed));
+      for (uint16_t i = 1; i < count; i++)
+        leds[i] = leds[0];
+
+      address += sizeof(CLed);
+      len -= sizeof(CLed);
+    }
+    else if (type != NzsSkip)
+    {
+      DBGPRINT("Invalid cue run type %u\n", type);
+      break;
+    }
+
+    leds += count;
+    numleds -= count;
+  }
+}
+
+//fall back to showing the data immediately when the ArtSync packets stop
+void CController::CheckSyncTimeout(uint32_t now)
+{
+  if (m_synced && now - m_synctime >= SYNCTIMEOUT)
+  {
+    DBGPRINT("No ArtSync received for %u ms, leaving synchronous mode\n", SYNCTIMEOUT);
+    m_synced = false;
+    m_syncpending = false;
+  }
+}
+
+//moves the dmx channels of leds to dest, palette indices are copied as they are
+void CController::CopyLedData(CLed* dest, const uint8_t* data, uint16_t channels)
+{
+#if PALETTE
+  if (dest != data)
+    memcpy(dest, data, channels);
+#else
+  CopyDmxData((uint8_t*)dest, data, channels);
+#endif
+}
+
+//moves dmx channels to dest, applying the channel order, gamma and brightness in a single pass,
+//dest can be the same as data
+void CController::CopyDmxData(uint8_t* dest, const uint8_t* data, uint16_t channels)
+{
+  if (m_plaincopy)
+  {
+    if (dest != data)
+      memcpy(dest, data, channels);
+    return;
+  }
+
+  const uint8_t* gamma = g_gammatables[m_gamma];
+  //value * (brightness + 1) / 256, written as value * brightness + value so the multiply stays 8x8 bits
+  uint8_t brightness = m_brightness;
+  uint8_t red = m_order[0];
+  uint8_t green = m_order[1];
+  uint8_t blue = m_order[2];
+
+  const uint8_t* end = data + channels - channels % 3;
+  while (data != end)
+  {
+    uint8_t r = pgm_read_byte(gamma + data[red]);
+    uint8_t g = pgm_read_byte(gamma + data[green]);
+    uint8_t b = pgm_read_byte(gamma + data[blue]);
+    dest[0] = ((uint16_t)(r * brightness) + r) >> 8;
+    dest[1] = ((uint16_t)(g * brightness) + g) >> 8;
+    dest[2] = ((uint16_t)(b * brightness) + b) >> 8;
+    data += 3;
+    dest += 3;
+  }
+
+  //channels of an incomplete led at the end can't be reordered
+  for (uint8_t i = 0; i < channels % 3; i++)
+  {
+    uint8_t value = pgm_read_byte(gamma + data[i]);
+    dest[i] = ((uint16_t)(value * brightness) + value) >> 8;
+  }
+}
+
+void CController::MergeDmxData(uint8_t source, uint16_t offset, uint8_t* data, uint16_t channels)
+{
+#if MERGE
+  uint8_t* sourcedata = (uint8_t*)(m_sourceleds[source] + offset);
+  uint8_t* otherdata = (uint8_t*)(m_sourceleds[source ^ 1] + offset);
+  uint8_t* leds = (uint8_t*)(m_leds + offset);
+
+  if (m_artnet.MergeLtp())
+  {
+    //latest takes precedence, output the channels this source changed since its previous packet
+    for (uint16_t i = 0; i < channels; i++)
+    {
+      uint8_t value = data[i];
+      if (value != sourcedata[i])
+      {
+        sourcedata[i] = value;
+        leds[i] = value;
+      }
+    }
+  }
+  else
+  {
+    //highest takes precedence
+    for (uint16_t i = 0; i < channels; i++)
+    {
+      uint8_t value = data[i];
+      uint8_t other = otherdata[i];
+      sourcedata[i] = value;
+      leds[i] = value > other ? value : other;
+    }
+  }
+#endif
+}
+
+void CController::OnSync()
+{
+#if ARTSYNC
+  uint32_t now = millis();
+
+  if (m_merging)
+  {
+    DBGPRINT("Ignoring ArtSync while merging\n");
+    return;
+  }
+
+  m_synctime = now;
+
+  if (!m_synced)
+  {
+    //the front buffer was just shown in immediate mode,
+    //start the back buffer from the same data, so that channels not sent by the controller stay the same
+    DBGPRINT("Entering synchronous mode\n");
+    memcpy(m_backleds, m_leds, sizeof(CLed) * NUM_LEDS);
+    m_synced = true;
+  }
+  else if (m_syncpending)
+  {
+    //swap the buffers, and show the one that was just filled
+    CLed* leds = m_leds;
+    m_leds = m_backleds;
+    m_backleds = leds;
+    m_syncpending = false;
+
+    ShowFrame(now);
+  }
+#else
+  DBGPRINT("Ignoring ArtSync, synchronous mode is not enabled\n");
+#endif
+}
+
+//true when no packet is waiting in the ENC28J60 and none arrived for RECEIVEIDLETIME microseconds,
+//or when the leds have waited for that since due for SHOWMAXDELAY milliseconds,
+//or so long that sending them would run into the next frame
+bool CController::ReceiveIdle(uint32_t due, uint32_t now)
+{
+  uint16_t showtime = m_showstats.Avg() / 1000 + SHOWMARGIN;
+  uint16_t maxdelay = m_frameperiod > showtime ? min(m_frameperiod - showtime, SHOWMAXDELAY) : 0;
+  if ((int32_t)(now - due) >= maxdelay)
+    return true;
+
+  return micros() - m_receivetime >= RECEIVEIDLETIME && HalNetReceivePending() == 0;
+}
+
+//called before the data of the next frame is written into the leds, when the controller sends without pauses,
+//a frame that is due but still waits for a gap in the traffic is shown now instead of being overwritten
+void CController::FlushFrame(uint32_t now)
+{
+  if (m_framepending && now - m_frametime >= m_frameperiod)
+    ShowFrame(now);
+}
+
+void CController::QueueFrame(uint32_t now)
+{
+  //the data of the pending frame has been overwritten by this one,
+  //if it should have been shown already, the node can't keep up
+  if (m_framepending)
+  {
+    if (now - m_framependingtime >= m_frameperiod)
+      m_framesdropped++;
+    else
+      m_framescoalesced++;
+  }
+
+  m_framepending = true;
+  m_framependingtime = now;
+
+  //Process() shows the frame once the frame period has passed,
+  //and the packets that came in right behind it are handled, see RECEIVEIDLETIME
+}
+
+void CController::ShowFrame(uint32_t now)
+{
+  m_framepending = false;
+  m_framesshown++;
+
+#if INTERPOLATE
+  //fade to the new frame over the average time between frames,
+  //frames that are too far apart are shown right away
+  uint32_t interval = now - m_frametime;
+  m_frametime = now;
+  if (interval < INTERPOLATEMAXINTERVAL)
+  {
+    m_frameinterval = m_frameinterval ? (m_frameinterval * 3 + interval) / 4 : interval;
+    m_fading = true;
+    m_fadestart = now;
+    return;
+  }
+
+  m_frameinterval = 0;
+  m_fading = false;
+#else
+  m_frametime = now;
+#endif
+
+  ShowLeds(now);
+}
+
+void CController::ShowEffect(uint32_t now)
+{
+  //number the leds across nodes, so the effect runs on from the node with the previous port address
+  uint32_t firstled = (uint32_t)m_artnet.PortAddress() * LEDS_PER_UNIVERSE;
+  m_effects.Render(m_leds, NUM_LEDS, firstled, now);
+
+#if !PALETTE
+  //the colors of the effect get the same channel order, gamma and brightness as ArtDmx
+  CopyDmxData((uint8_t*)m_leds, (uint8_t*)m_leds, sizeof(CRGB) * NUM_LEDS);
+#endif
+
+  m_framesshown++;
+  ShowLeds(now);
+}
+
+void CController::ShowLeds(uint32_t now)
+{
+  uint32_t start = micros();
+#if PALETTE
+  HalLedsShowPalette(m_leds, m_palette, PALETTESIZE, NUM_LEDS);
+#else
+  HalLedsShow(m_leds, NUM_LEDS);
+#endif
+  m_showstats.Add(micros() - start);
+  m_ledshowtime = now;
+
+  RetainFrame();
+}
+
+#if INTERPOLATE
+void CController::ShowFade(uint32_t now)
+{
+  uint16_t weight = FadeWeight(now);
+  if (weight > 255)
+  {
+    m_fading = false;
+    ShowLeds(now);
+    return;
+  }
+
+  //the transmit buffer is free until the next HalNetPoll()
+  CRGB* leds = (CRGB*)HalNetTransmitBuffer();
+  FadeLeds((uint8_t*)leds, (uint8_t*)m_prevleds, (uint8_t*)m_leds, weight);
+
+  uint32_t start = micros();
+  HalLedsShow(leds, NUM_LEDS);
+  m_showstats.Add(micros() - start);
+  m_ledshowtime = now;
+}
+
+//the next fade starts from what the leds show now
+void CController::StartFade(uint32_t now)
+{
+  uint16_t weight = FadeWeight(now);
+  if (weight > 255)
+    memcpy(m_prevleds, m_leds, sizeof(CLed) * NUM_LEDS);
+  else
+    FadeLeds((uint8_t*)m_prevleds, (uint8_t*)m_prevleds, (uint8_t*)m_leds, weight);
+}
+
+//returns how far the fade has progressed, 256 when it's done
+uint16_t CController::FadeWeight(uint32_t now)
+{
+  uint32_t elapsed = now - m_fadestart;
+  if (!m_fading || elapsed >= m_frameinterval)
+    return 256;
+
+  return elapsed * 256 / m_frameinterval;
+}
+
+//dest = from + (to - from) * weight / 256, dest can be the same as from
+void CController::FadeLeds(uint8_t* dest, const uint8_t* from, const uint8_t* to, uint8_t weight)
+{
+  for (uint16_t i = 0; i < sizeof(CRGB) * NUM_LEDS; i++)
+  {
+    //8x8 bit unsigned multiplies only
+    uint8_t a = from[i];
+    uint8_t b = to[i];
+    if (b >= a)
+      dest[i] = a + (uint8_t)(((uint16_t)(uint8_t)(b - a) * weight) >> 8);
+    else
+      dest[i] = a - (uint8_t)(((uint16_t)(uint8_t)(a - b) * weight) >> 8);
+  }
+}
+#endif
+
+//writes the timing statistics as text, and starts measuring them again
+uint16_t CController::FormatStats(char* buf, uint16_t size)
+{
+  int len = snprintf_P(buf, size,
+                       PSTR("min/avg/max us recv %u/%u/%u parse %u/%u/%u copy %u/%u/%u show %u/%u/%u loop %u/%u/%u, "
+                            "packets %lu frames %lu coalesced %lu dropped %lu, %u fps"),
+                       m_recvstats.Min(), m_recvstats.Avg(), m_recvstats.Max(),
+                       m_parsestats.Min(), m_parsestats.Avg(), m_parsestats.Max(),
+                       m_copystats.Min(), m_copystats.Avg(), m_copystats.Max(),
+                       m_showstats.Min(), m_showstats.Avg(), m_showstats.Max(),
+                       m_loopstats.Min(), m_loopstats.Avg(), m_loopstats.Max(),
+                       (unsigned long)m_packets, (unsigned long)m_framesshown,
+                       (unsigned long)m_framescoalesced, (unsigned long)m_framesdropped, m_fps);
+
+  m_recvstats.Reset();
+  m_parsestats.Reset();
+  m_copystats.Reset();
+  m_showstats.Reset();
+  m_loopstats.Reset();
+
+  return len < 0 ? 0 : min((uint16_t)len, size - 1);
+}
+
+void CController::OnTrigger(uint8_t effect, const uint8_t* data, uint16_t len)
+{
+  if (!m_effects.Start(effect, data, len, millis()))
+    return;
+
+  //the effect replaces the frames received so far, EffectNone leaves the last frame on the leds
+  m_framepending = false;
+  m_universesreceived = 0;
+  m_syncpending = false;
+  m_fading = false;
+}
+
+//keeps the timecode, Process() plays the cues from it
+void CController::OnTimeCode(uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, uint8_t type)
+{
+  static const uint8_t fps[] = { 24, 25, 30, 30 }; //see TimeCodeType, drop frame timecode is counted as 30 fps
+
+  m_timecodefps = fps[type & 3];
+  m_timecode = (((uint32_t)hours * 60 + minutes) * 60 + seconds) * m_timecodefps + frames;
+  m_timecodetime = millis();
+  m_playframe = m_timecode - 1; //play the received frame, even if the cues already got there
+}
+
+//applies the cues up to the last received timecode, counting on from it at its frame rate until the next one arrives
+void CController::PlayCues(uint32_t now)
+{
+#if NUM_LEDBUFFERS > 0
+  if (m_timecodefps == 0 || now - m_timecodetime >= TIMECODEFREEWHEEL)
+    return;
+
+  uint32_t frame = m_timecode + (now - m_timecodetime) * m_timecodefps / 1000;
+  if (frame == m_playframe)
+    return;
+  m_playframe = frame;
+
+  uint32_t seconds = frame / m_timecodefps;
+  uint32_t time = CueTime(seconds / 3600, seconds / 60 % 60, seconds % 60, frame % m_timecodefps);
+
+  //the timecode went back, start again from the first cue
+  if (m_cue >= 0 && time < m_cuetime)
+    m_cue = -1;
+
+  if (ApplyCues(time))
+  {
+    m_effects.Stop();
+    m_universesreceived = 0;
+    QueueFrame(now);
+  }
+#endif
+}
+
+//handles the keywords of ArtCommand:
+//Gamma=2.2 selects one of the gamma tables
+//Brightness=128 scales all channels by 128/255
+//Order=GRB sets the order of the channels in the dmx data
+void CController::OnCommand(const char* keyword, const char* value)
+{
+  if (strcasecmp_P(keyword, PSTR("Gamma")) == 0)
+  {
+    //parse the gamma value in tenths, with at most 2 digits before the point,
+    //values above 25.5 don't fit in the 8 bits of the gamma tables
+    const char* digit = value;
+    uint16_t gamma = 0;
+    for (uint8_t i = 0; i < 2 && *digit >= '0' && *digit <= '9'; i++)
+      gamma = gamma * 10 + *digit++ - '0';
+    gamma *= 10;
+    if (*digit == '.' && digit[1] >= '0' && digit[1] <= '9')
+      gamma += digit[1] - '0';
+
+    if ((*digit >= '0' && *digit <= '9') || gamma > 255 || !SetGamma(gamma))
+      DBGPRINT("Unsupported gamma %s\n", value);
+  }
+  else if (strcasecmp_P(keyword, PSTR("Brightness")) == 0)
+  {
+    SetBrightness(min(strtoul(value, NULL, 10), 255));
+  }
+  else if (strcasecmp_P(keyword, PSTR("Order")) == 0)
+  {
+    if (!SetChannelOrder(value))
+      DBGPRINT("Invalid channel order %s\n", value);
+  }
+}
+
+bool CController::SetGamma(uint8_t gamma)
+{
+  for (uint8_t i = 0; i < NUM_GAMMATABLES; i++)
+  {
+    if (g_gammavalues[i] == gamma)
+    {
+      m_gamma = i;
+      UpdatePlainCopy();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void CController::SetBrightness(uint8_t brightness)
+{
+  m_brightness = brightness;
+  UpdatePlainCopy();
+}
+
+//order is a permutation of "RGB", in the order the channels are in the dmx data
+bool CController::SetChannelOrder(const char* order)
+{
+  static const char colors[] = "RGB";
+  uint8_t neworder[3];
+  uint8_t found = 0;
+  if (strlen(order) != 3)
+    return false;
+
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    const char* color = strchr(colors, order[i] & ~0x20); //uppercase
+    if (!color || (found & (1 << (color - colors))))
+      return false;
+
+    neworder[color - colors] = i;
+    found |= 1 << (color - colors);
+  }
+
+  memcpy(m_order, neworder, sizeof(m_order));
+  UpdatePlainCopy();
+  return true;
+}
+
+void CController::UpdatePlainCopy()
+{
+  m_plaincopy = m_gamma == 0 && m_brightness == 255 && m_order[0] == 0 && m_order[1] == 1 && m_order[2] == 2;
+}
+
+void CController::SetMaxFps(uint8_t fps)
+{
+  m_frameperiod = fps ? 1000 / fps : 0;
 }
 
 void CController::OnValidData()
 {
   m_validdatatime = millis();
-  wdt_reset();
+  HalWatchdogReset();
 }
 
@@ -1,12 +1,129 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#ifndef STATIC
 #define STATIC 0
+#endif
 
-#include <FastSPI_LED2.h>
+#include "hal.h"
 #include "artnet.h"
+#include "sacn.h"
+#include "stats.h"
+#include "leds.h"
+#include "effects.h"
+#include "cues.h"
 
-#define NUM_LEDS 170
+#define NUM_LEDS (LEDS_PER_UNIVERSE * NUM_UNIVERSES)
+
+//when ARTSYNC is enabled, ArtDmx data is written into a back buffer,
+//which is swapped with the front buffer and shown when an ArtSync packet arrives
+//this costs another NUM_LEDS * 3 bytes of RAM
+#ifndef ARTSYNC
+#define ARTSYNC 0
+#endif
+
+//when ZEROCOPY is enabled, the leds are shown straight from the ArtDmx data in the ethernet buffer,
+//this saves NUM_LEDS * 3 bytes of RAM and a memcpy for every frame
+//since the next packet is received into the same buffer, the leds are not refreshed every second,
+//unless ZEROCOPY_KEEPALIVE is enabled, which keeps a copy of the frame after it's been shown
+#ifndef ZEROCOPY
+#define ZEROCOPY 0
+#endif
+
+#ifndef ZEROCOPY_KEEPALIVE
+#define ZEROCOPY_KEEPALIVE 0
+#endif
+
+#if ZEROCOPY && (ARTSYNC || NUM_UNIVERSES > 1)
+#error ZEROCOPY can only be used with a single universe and without ARTSYNC
+#endif
+
+//when MERGE is enabled, ArtDmx from two controllers is merged, in HTP or LTP mode as set with ArtAddress
+//the last data of each controller is kept, which costs another 2 * NUM_LEDS * 3 bytes of RAM,
+//with the led buffer and the ethernet buffer that's more than the 2 KB of the ATmega328P, so it's for the host builds only
+#ifndef MERGE
+#define MERGE 0
+#endif
+
+#if MERGE && ZEROCOPY
+#error MERGE can not be used with ZEROCOPY
+#endif
+
+#if MERGE && defined(__AVR__)
+#error MERGE needs 3 * NUM_LEDS * 3 bytes of RAM for the led buffers besides the ethernet buffer, more than the ATmega328P has
+#endif
+
+//when INTERPOLATE is enabled, the leds are refreshed INTERPOLATEFPS times per second,
+//fading from the previous frame to the current one over the measured time between frames,
+//the previous frame costs another NUM_LEDS * 3 bytes of RAM, the fades are rendered into the transmit buffer
+#ifndef INTERPOLATE
+#define INTERPOLATE 0
+#endif
+
+#ifndef INTERPOLATEFPS
+#define INTERPOLATEFPS 50
+#endif
+
+//frames further apart than this many milliseconds are shown without fading
+#define INTERPOLATEMAXINTERVAL 250
+
+#if INTERPOLATE && (ARTSYNC || ZEROCOPY || NUM_UNIVERSES > 1)
+#error INTERPOLATE can only be used with a single universe and without ARTSYNC or ZEROCOPY
+#endif
+
+#if PALETTE && (ZEROCOPY || MERGE || INTERPOLATE)
+#error PALETTE can not be used with ZEROCOPY, MERGE or INTERPOLATE
+#endif
+
+#define LED_KEEPALIVE (!ZEROCOPY || ZEROCOPY_KEEPALIVE)
+#define NUM_LEDBUFFERS (!LED_KEEPALIVE ? 0 : (ARTSYNC || INTERPOLATE) ? 2 : 1)
+
+//if no ArtSync is received for this many milliseconds, ArtDmx data is shown immediately again
+#define SYNCTIMEOUT 4000
+
+//the leds are sent with interrupts off, for about 5 ms with a full universe on a WS2812B strip,
+//the ENC28J60 keeps receiving into its buffer meanwhile, which overflows when a burst of packets comes in,
+//so frames, effects, fades and the keepalive are shown once no packet arrived for RECEIVEIDLETIME microseconds,
+//a bit longer than a full ArtDmx takes on the 10 Mbit link, so a burst of universes for other nodes is handled first
+//and the whole buffer is free, unless that takes more than SHOWMAXDELAY milliseconds,
+//or more than the frame period minus the time it takes to send the leds and SHOWMARGIN milliseconds,
+//so they're done before the next frame comes in, without a frame rate limit they're not held back,
+//the strip can't be sent in parts with packets handled in between, since it latches after 50 us,
+//with ZEROCOPY or ArtSync the leds are still shown right away
+#define RECEIVEIDLETIME 600
+#define SHOWMAXDELAY    10
+#define SHOWMARGIN      3
+
+//maximum number of frames per second shown on the leds, 0 means no limit
+//when frames arrive faster, only the newest one is shown when the next frame is due
+#ifndef MAXFPS
+#define MAXFPS 44
+#endif
+
+//the led buffers, the palette, and what's needed to show them again are kept in RAM that isn't cleared at startup,
+//after a watchdog reset the last frame is shown again straight away, instead of white leds
+//the checksum is updated whenever the leds are shown, so random RAM after power up isn't shown
+#define RETAINMAGIC 0x4C46 //"LF"
+
+//bytes of RAM left for EtherCard, FastSPI_LED2, the Arduino core and the stack,
+//besides SRetained, the controller and the ethernet buffer
+#define RAMRESERVE 256
+
+struct SRetained
+{
+#if NUM_LEDBUFFERS > 0
+  CLed     ledbuffers[NUM_LEDBUFFERS][NUM_LEDS];
+#endif
+#if PALETTE
+  CRGB     palette[PALETTESIZE];
+#endif
+  uint16_t magic;
+  uint8_t  front;      //index of the buffer being shown
+  uint8_t  gamma;
+  uint8_t  brightness;
+  uint8_t  order[3];
+  uint16_t checksum;   //of the buffer being shown, the palette and the settings above
+};
 
 class CController
 {
@@ -14,19 +131,120 @@ class CController
     CController();
 
     void    Initialize();
+    void    Poll();
     void    Process();
+    uint16_t ClassifyPacket(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len);
     void    HandlePacket(byte ip[4], uint16_t port, uint8_t* data, uint16_t len);
     void    Transmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport);
-    void    OnDmxData(uint8_t* data, uint16_t channels);
+    void    OnDmxData(uint8_t source, uint8_t universe, uint8_t* data, uint16_t channels);
+    void    OnNzsData(uint8_t universe, uint16_t start, uint8_t flags, const uint8_t* data, uint16_t len);
+    void    OnSync();
     void    OnValidData();
+    void    OnCommand(const char* keyword, const char* value);
+    void    OnTrigger(uint8_t effect, const uint8_t* data, uint16_t len);
+    void    OnTimeCode(uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, uint8_t type);
+    void    SetMaxFps(uint8_t fps);
+    bool    SetGamma(uint8_t gamma);
+    void    SetBrightness(uint8_t brightness);
+    bool    SetChannelOrder(const char* order);
+    uint8_t  Fps()      { return m_fps; }
+    uint16_t ShowTime() { return m_showstats.Avg(); }
+    uint32_t DmxTime()  { return m_dmxtime; }
+    uint16_t FormatStats(char* buf, uint16_t size);
 
   private:
     void    SetPortAddressFromIp();
+    void    WaitForLink();
+    bool    RestoreFrame();
+    void    RetainFrame();
+    uint16_t RetainedChecksum();
+    bool    UseStoredLease();
+    void    StoreLease();
+    void    HandleDmxData(uint8_t source, uint8_t universe, uint8_t* data, uint16_t channels);
+    void    HandleNzsData(uint8_t universe, uint16_t start, uint8_t flags, const uint8_t* data, uint16_t len);
+    void    StageCueData(uint16_t start, const uint8_t* data, uint16_t len);
+    void    WriteCueData();
+    bool    ApplyCues(uint32_t time);
+    void    PlayCues(uint32_t now);
+    void    DecodeCueData(CLed* leds, uint16_t numleds, uint16_t address, uint16_t len);
+    void    SetPaletteData(uint16_t start, const uint8_t* data, uint16_t len);
+    void    DecodeNzsData(CLed* leds, uint16_t numleds, const uint8_t* data, uint16_t len);
+    void    CheckSyncTimeout(uint32_t now);
+    void    CopyDmxData(uint8_t* dest, const uint8_t* data, uint16_t channels);
+    void    CopyLedData(CLed* dest, const uint8_t* data, uint16_t channels);
+    void    UpdatePlainCopy();
+    void    MergeDmxData(uint8_t source, uint16_t offset, uint8_t* data, uint16_t channels);
+    bool    ReceiveIdle(uint32_t due, uint32_t now);
+    void    FlushFrame(uint32_t now);
+    void    QueueFrame(uint32_t now);
+    void    ShowFrame(uint32_t now);
+    void    ShowEffect(uint32_t now);
+    void    ShowLeds(uint32_t now);
+    void    ShowFade(uint32_t now);
+    void    StartFade(uint32_t now);
+    uint16_t FadeWeight(uint32_t now);
+    void    FadeLeds(uint8_t* dest, const uint8_t* from, const uint8_t* to, uint8_t weight);
 
     CArtNet  m_artnet;
-    CRGB     m_leds[NUM_LEDS];
-    uint32_t m_ledshowtime; 
+#if SACN
+    CSacn    m_sacn;
+#endif
+    CEffects m_effects;
+#if MERGE
+    CLed     m_sourceleds[NUM_SOURCES][NUM_LEDS]; //the last data received from each source
+#endif
+#if PALETTE
+    CRGB*    m_palette;  //PALETTESIZE colors, kept in SRetained
+#endif
+    bool     m_merging;
+    CLed*    m_leds;     //the buffer being shown
+    CLed*    m_backleds; //the buffer ArtDmx data is written into in synchronous mode
+    CLed*    m_prevleds; //the frame the leds fade from in interpolation mode
+    bool     m_synced;
+    bool     m_syncpending;
+    uint32_t m_synctime;
+    uint16_t m_universesreceived; //bitmask of the universes received for the current frame
+    uint32_t m_ledshowtime;
+    uint32_t m_frametime;        //when the last frame was shown, or started fading in
+    uint16_t m_frameperiod;      //minimum number of milliseconds between shown frames
+    bool     m_framepending;     //a frame is waiting in m_leds until m_frameperiod has passed
+    uint32_t m_framependingtime;
+    uint32_t m_framesshown;
+    uint32_t m_framescoalesced;  //pending frames replaced by a newer one because of the frame rate limit
+    uint32_t m_framesdropped;    //pending frames replaced by a newer one because Process() didn't show them in time
     uint32_t m_validdatatime;
+    uint32_t m_dmxtime;      //when led data was last received, 0 if never
+    int16_t  m_cue;         //the last cue applied to the leds, -1 if none
+    uint32_t m_cuetime;     //its time, see CueTime()
+    uint16_t m_cueaddress;  //the EEPROM address after it
+    uint32_t m_timecode;     //the last received timecode, in frames
+    uint8_t  m_timecodefps;  //its frame rate, 0 if no timecode was received
+    uint32_t m_timecodetime; //when it was received
+    uint32_t m_playframe;    //the frame the cues were last played up to
+    uint8_t  m_cueblock[CUEBLOCKSIZE]; //part of the cue table waiting to be written to the EEPROM
+    uint16_t m_cueblockstart;          //its offset in the cue table
+    uint8_t  m_cueblocklen;
+    uint8_t  m_cueblockwritten;        //bytes of it written so far
+    bool     m_fading;
+    uint32_t m_fadestart;
+    uint16_t m_frameinterval;    //average time between received frames, which is how long a fade takes
+    CTimeStats m_recvstats;   //reading a packet from the network controller
+    CTimeStats m_parsestats;  //handling an Art-Net packet, without copying dmx data
+    CTimeStats m_copystats;   //copying dmx data into the leds
+    CTimeStats m_showstats;   //sending the leds
+    CTimeStats m_loopstats;   //one iteration of the main loop
+    uint32_t m_looptime;
+    uint32_t m_receivetime;   //micros() when HalNetPoll() last read a packet
+    uint32_t m_parsetime;     //duration of the packet handled in the current Poll()
+    uint32_t m_copytime;      //duration of the dmx copy in the current packet
+    uint32_t m_packets;
+    uint8_t  m_fps;
+    uint32_t m_fpstime;
+    uint32_t m_fpsframes;
+    uint8_t  m_gamma;        //index into g_gammatables
+    uint8_t  m_brightness;   //255 is full brightness
+    uint8_t  m_order[3];     //position of red, green and blue in the dmx data
+    bool     m_plaincopy;    //gamma 1.0, full brightness and RGB order, so CopyDmxData is a memcpy
 };
 
 #endif //CONTROLLER_H
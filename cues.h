@@ -0,0 +1,52 @@
+#ifndef CUES_H
+#define CUES_H
+
+#include "hal.h"
+#include "settings.h"
+
+//cues are frames stored in the EEPROM, each is shown when ArtTimeCode reaches its time,
+//so only timecode has to cross the network during the show
+//the table is uploaded with ArtNzs (NzsCues), it starts with SCueTable, followed by the cues,
+//each an SCue followed by runs in the same format as ArtNzs led data,
+//a cue only needs the leds that changed since the previous cue, the first cue should set every led
+#define CUEADDRESS   0
+#define CUETABLESIZE (SETTINGSADDRESS - CUEADDRESS) //the node settings follow the cue table
+
+//written last by the upload, so a table that's only partly uploaded isn't played
+#define CUEMAGIC 0x4355 //"CU"
+
+//the node keeps one block of the upload in RAM and writes it to the EEPROM a byte per loop,
+//a block that arrives before the previous one is written is dropped,
+//so the uploader has to wait longer than CUEBLOCKSIZE * 3.3 ms between blocks
+#define CUEBLOCKSIZE 32
+
+//between ArtTimeCode packets the node counts the frames itself from the last received timecode,
+//playback stops when no timecode arrived for this many milliseconds
+#define TIMECODEFREEWHEEL 1000
+
+struct SCueTable
+{
+  uint8_t MagicHi;
+  uint8_t MagicLo;
+  uint8_t NumCues;
+} __attribute__((packed));
+
+struct SCue
+{
+  uint8_t Hours;
+  uint8_t Minutes;
+  uint8_t Seconds;
+  uint8_t Frames;
+  uint8_t StartHi; //first led of the runs
+  uint8_t StartLo;
+  uint8_t LengthHi; //bytes of runs after the cue
+  uint8_t LengthLo;
+} __attribute__((packed));
+
+//a timecode as a number that sorts the same as the time, for any frame rate
+inline uint32_t CueTime(uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames)
+{
+  return ((uint32_t)hours << 24) | ((uint32_t)minutes << 16) | ((uint16_t)seconds << 8) | frames;
+}
+
+#endif //CUES_H
@@ -1,7 +1,9 @@
 #ifndef DEBUGPRINT_H
 #define DEBUGPRINT_H
 
+#ifndef DEBUG
 #define DEBUG 0
+#endif
 
 #if DEBUG
 #define DBGPRINT(str, ...) printf_P(PSTR("%i %lu: " str), __LINE__, millis(), ##__VA_ARGS__)
@@ -0,0 +1,103 @@
+#include "dhcp.h"
+
+static void WriteUint32(uint8_t* data, uint32_t value)
+{
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+static uint32_t ReadUint32(const uint8_t* data)
+{
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint16_t)data[2] << 8) | data[3];
+}
+
+uint16_t DhcpRebootRequest(uint8_t* data, const uint8_t* mac, const uint8_t* ip, uint32_t xid)
+{
+  SDhcpMessage* request = (SDhcpMessage*)data;
+  memset(request, 0, sizeof(SDhcpMessage));
+  request->Op = 1; //BOOTREQUEST
+  request->HType = 1; //ethernet
+  request->HLen = 6;
+  WriteUint32(request->Xid, xid);
+  //ciaddr stays 0 and the broadcast flag off, so the server unicasts the reply to the requested address
+  memcpy(request->Chaddr, mac, 6);
+  WriteUint32(request->Magic, DHCPMAGIC);
+
+  uint8_t* option = data + sizeof(SDhcpMessage);
+  *option++ = DhcpOptMessageType;
+  *option++ = 1;
+  *option++ = DhcpRequest;
+
+  *option++ = DhcpOptClientId;
+  *option++ = 7;
+  *option++ = 1; //hardware type ethernet
+  memcpy(option, mac, 6);
+  option += 6;
+
+  *option++ = DhcpOptRequestedIp;
+  *option++ = 4;
+  memcpy(option, ip, 4);
+  option += 4;
+
+  *option++ = DhcpOptParameterList;
+  *option++ = 4;
+  *option++ = DhcpOptMask;
+  *option++ = DhcpOptRouter;
+  *option++ = DhcpOptDns;
+  *option++ = DhcpOptLeaseTime;
+
+  *option++ = DhcpOptEnd;
+
+  return option - data;
+}
+
+uint8_t DhcpParseReply(const uint8_t* data, uint16_t len, const uint8_t* mac, uint32_t xid, SDhcpLease* lease)
+{
+  if (len < sizeof(SDhcpMessage))
+    return 0;
+
+  const SDhcpMessage* reply = (const SDhcpMessage*)data;
+  if (reply->Op != 2 || ReadUint32(reply->Xid) != xid || memcmp(reply->Chaddr, mac, 6) != 0 ||
+      ReadUint32(reply->Magic) != DHCPMAGIC)
+    return 0;
+
+  uint8_t type = 0;
+  SDhcpLease offered = *lease;
+  memcpy(offered.Ip, reply->Yiaddr, sizeof(offered.Ip));
+
+  const uint8_t* option = data + sizeof(SDhcpMessage);
+  const uint8_t* end = data + len;
+  while (option < end && *option != DhcpOptEnd)
+  {
+    if (*option == DhcpOptPad)
+    {
+      option++;
+      continue;
+    }
+
+    if (option + 2 > end || option + 2 + option[1] > end)
+      break;
+
+    uint8_t optionlen = option[1];
+    const uint8_t* value = option + 2;
+    if (option[0] == DhcpOptMessageType && optionlen >= 1)
+      type = value[0];
+    else if (option[0] == DhcpOptMask && optionlen >= 4)
+      memcpy(offered.Mask, value, 4);
+    else if (option[0] == DhcpOptRouter && optionlen >= 4)
+      memcpy(offered.Gateway, value, 4);
+    else if (option[0] == DhcpOptDns && optionlen >= 4)
+      memcpy(offered.Dns, value, 4);
+    else if (option[0] == DhcpOptLeaseTime && optionlen >= 4)
+      offered.LeaseTime = ReadUint32(value);
+
+    option += 2 + optionlen;
+  }
+
+  if (type == DhcpAck)
+    *lease = offered;
+
+  return type == DhcpAck || type == DhcpNak ? type : 0;
+}
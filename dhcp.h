@@ -0,0 +1,83 @@
+#ifndef DHCP_H
+#define DHCP_H
+
+#include "hal.h"
+
+#define DHCPSERVERPORT 67
+#define DHCPCLIENTPORT 68
+
+//after a reset the node confirms its stored lease with a DHCPREQUEST from the INIT-REBOOT state of RFC 2131,
+//it keeps using the address meanwhile, until the server answers with a DHCPNAK,
+//an unanswered request is sent again after DHCPREBOOTINTERVAL milliseconds,
+//after DHCPREBOOTTRIES of them once every DHCPREBOOTRETRY milliseconds
+#define DHCPREBOOTINTERVAL 4000
+#define DHCPREBOOTTRIES    4
+#define DHCPREBOOTRETRY    60000
+
+//the lease is confirmed again at half its time, longer leases count as this many seconds,
+//so the time in milliseconds fits in an int32_t
+#define DHCPMAXLEASE 2000000UL
+
+#define DHCPMAGIC 0x63825363
+
+enum DhcpMessageType
+{
+  DhcpRequest = 3,
+  DhcpAck     = 5,
+  DhcpNak     = 6,
+};
+
+enum DhcpOption
+{
+  DhcpOptPad             = 0,
+  DhcpOptMask            = 1,
+  DhcpOptRouter          = 3,
+  DhcpOptDns             = 6,
+  DhcpOptRequestedIp     = 50,
+  DhcpOptLeaseTime       = 51,
+  DhcpOptMessageType     = 53,
+  DhcpOptParameterList   = 55,
+  DhcpOptClientId        = 61,
+  DhcpOptEnd             = 255,
+};
+
+//a BOOTP message, the options follow it
+struct SDhcpMessage
+{
+  uint8_t     Op;
+  uint8_t     HType;
+  uint8_t     HLen;
+  uint8_t     Hops;
+  uint8_t     Xid[4];
+  uint8_t     SecsHi;
+  uint8_t     SecsLo;
+  uint8_t     FlagsHi;
+  uint8_t     FlagsLo;
+  uint8_t     Ciaddr[4];
+  uint8_t     Yiaddr[4];
+  uint8_t     Siaddr[4];
+  uint8_t     Giaddr[4];
+  uint8_t     Chaddr[16];
+  uint8_t     Sname[64];
+  uint8_t     File[128];
+  uint8_t     Magic[4];
+} __attribute__((packed));
+
+struct SDhcpLease
+{
+  uint8_t  Ip[4];
+  uint8_t  Mask[4];
+  uint8_t  Gateway[4];
+  uint8_t  Dns[4];
+  uint32_t LeaseTime; //seconds
+};
+
+//writes a DHCPREQUEST for ip into data, from the INIT-REBOOT state, returns its size,
+//it's sent from 0.0.0.0 to the broadcast address, with the same client identifier EtherCard uses
+uint16_t DhcpRebootRequest(uint8_t* data, const uint8_t* mac, const uint8_t* ip, uint32_t xid);
+
+//returns DhcpAck or DhcpNak for a reply to the request with xid, 0 for any other packet,
+//an ack sets the fields of lease that it has options for
+uint8_t  DhcpParseReply(const uint8_t* data, uint16_t len, const uint8_t* mac, uint32_t xid, SDhcpLease* lease);
+
+#endif //DHCP_H
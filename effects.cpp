@@ -0,0 +1,171 @@
+#include "effects.h"
+#include "debugprint.h"
+
+//one period of a sine, from 0 up to 255 at 128 and back
+static const uint8_t g_wavetable[256] PROGMEM =
+{
+    0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+   10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+   37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+   79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+  128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+  176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+  218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+  245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+  255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+  245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+  218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+  176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+  128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+   79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+   37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+   10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+};
+
+static const SEffectParams g_effectdefaults PROGMEM =
+{
+  {255, 255, 255}, //Color1
+  {0, 0, 0},       //Color2
+  64,              //Speed
+  16,              //Size
+};
+
+//a pseudo random level for every lattice point of the noise
+static uint8_t NoiseValue(uint16_t x, uint16_t y)
+{
+  uint16_t hash = x * 31421 + y * 6927 + 1;
+  hash ^= hash >> 7;
+  hash *= 0x2F;
+  return hash >> 8;
+}
+
+//weight 0 is a, 255 is b, the difference is kept unsigned so it can't overflow a 16 bit int
+static uint8_t Mix(uint8_t a, uint8_t b, uint8_t weight)
+{
+  uint16_t scale = (uint16_t)weight + 1;
+  if (b >= a)
+    return a + ((uint16_t)(b - a) * scale >> 8);
+  else
+    return a - ((uint16_t)(a - b) * scale >> 8);
+}
+
+bool CEffects::Start(uint8_t effect, const uint8_t* data, uint16_t len, uint32_t now)
+{
+  if (effect >= EffectMax)
+  {
+    DBGPRINT("Unknown effect %u\n", effect);
+    return false;
+  }
+
+  memcpy_P(&m_params, &g_effectdefaults, sizeof(m_params));
+  memcpy(&m_params, data, min(len, sizeof(m_params)));
+  if (m_params.Size == 0)
+    m_params.Size = 1;
+
+  m_effect = effect;
+  m_starttime = now;
+
+  DBGPRINT("Starting effect %u\n", effect);
+  return true;
+}
+
+//the phase in 1/256 periods of the effects that use Speed as a rate, a period takes 256 ms at Speed 64,
+//split up so it doesn't overflow for 300 hours
+uint32_t CEffects::Phase(uint32_t now)
+{
+  uint32_t elapsed = now - m_starttime;
+  return (elapsed >> 6) * m_params.Speed + (((elapsed & 63) * m_params.Speed) >> 6);
+}
+
+void CEffects::Render(CLed* leds, uint16_t numleds, uint32_t firstled, uint32_t now)
+{
+  uint32_t elapsed = now - m_starttime;
+  uint8_t  size = m_params.Size;
+
+  if (m_effect == EffectSolid)
+  {
+    for (uint16_t i = 0; i < numleds; i++)
+      SetLed(leds[i], 255);
+  }
+  else if (m_effect == EffectChase)
+  {
+    //position in 1/256 leds, Speed / 4 per millisecond is close enough to Speed leds per second,
+    //the time is taken modulo a whole number of periods first, so it doesn't overflow
+    uint32_t period = (uint32_t)size << 9;
+    uint32_t position = elapsed % (period * 4) * m_params.Speed / 4 % period;
+    uint32_t led = ((firstled << 8) + period - position) % period;
+    for (uint16_t i = 0; i < numleds; i++)
+    {
+      SetLed(leds[i], led < period / 2 ? 255 : 0);
+      led += 256;
+      if (led >= period)
+        led -= period;
+    }
+  }
+  else if (m_effect == EffectPulse)
+  {
+    uint8_t level = pgm_read_byte(g_wavetable + (uint8_t)Phase(now));
+    for (uint16_t i = 0; i < numleds; i++)
+      SetLed(leds[i], level);
+  }
+  else if (m_effect == EffectRainbow)
+  {
+    //hue in 1/256 steps, so wheels longer than 256 leds still turn smoothly
+    uint16_t step = 65535U / size;
+    uint16_t hue = (uint16_t)(firstled * step) - ((uint16_t)Phase(now) << 8);
+    for (uint16_t i = 0; i < numleds; i++)
+    {
+      SetHue(leds[i], hue >> 8);
+      hue += step;
+    }
+  }
+  else if (m_effect == EffectNoise)
+  {
+    //value noise: random levels every Size leds and every period of the phase, mixed linearly in between,
+    //the position between two random levels is in 1/65536 steps
+    uint32_t time = Phase(now);
+    uint16_t y = time >> 8;
+    uint8_t  ty = time;
+    uint16_t x = firstled / size;
+    uint32_t step = 65536UL / size;
+    uint32_t tx = firstled % size * step;
+    uint8_t  left = Mix(NoiseValue(x, y), NoiseValue(x, y + 1), ty);
+    uint8_t  right = Mix(NoiseValue(x + 1, y), NoiseValue(x + 1, y + 1), ty);
+    for (uint16_t i = 0; i < numleds; i++)
+    {
+      SetLed(leds[i], Mix(left, right, tx >> 8));
+      tx += step;
+      if (tx >= 65536UL - size) //rounding down the step would otherwise delay the next level by a led
+      {
+        tx = 0;
+        x++;
+        left = right;
+        right = Mix(NoiseValue(x + 1, y), NoiseValue(x + 1, y + 1), ty);
+      }
+    }
+  }
+}
+
+//level 0 is Color2, 255 is Color1
+void CEffects::SetLed(CLed& led, uint8_t level)
+{
+#if PALETTE
+  led = level;
+#else
+  led.r = Mix(m_params.Color2[0], m_params.Color1[0], level);
+  led.g = Mix(m_params.Color2[1], m_params.Color1[1], level);
+  led.b = Mix(m_params.Color2[2], m_params.Color1[2], level);
+#endif
+}
+
+//red, green and blue follow the wave a third of a period apart
+void CEffects::SetHue(CLed& led, uint8_t hue)
+{
+#if PALETTE
+  led = hue;
+#else
+  led.r = pgm_read_byte(g_wavetable + (uint8_t)(hue + 128));
+  led.g = pgm_read_byte(g_wavetable + (uint8_t)(hue + 128 + 85));
+  led.b = pgm_read_byte(g_wavetable + (uint8_t)(hue + 128 + 171));
+#endif
+}
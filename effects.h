@@ -0,0 +1,58 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "hal.h"
+#include "leds.h"
+
+//effects rendered on the node, started with ArtTrigger (KeyMacro, SubKey is the effect, Data is SEffectParams),
+//ArtDmx or ArtNzs led data stops them
+
+//frames per second the effect is rendered at
+#ifndef EFFECTFPS
+#define EFFECTFPS 40
+#endif
+
+enum Effect
+{
+  EffectNone    = 0, //stop the effect, the leds keep the last frame
+  EffectSolid   = 1, //all leds Color1
+  EffectChase   = 2, //blocks of Size leds of Color1 and Color2, moving Speed leds per second
+  EffectPulse   = 3, //all leds fade from Color2 to Color1 and back, Speed 64 takes 256 ms
+  EffectRainbow = 4, //a color wheel over Size leds, turning as fast as EffectPulse
+  EffectNoise   = 5, //smooth random mix of Color1 and Color2, changing as fast as EffectPulse
+  EffectMax,
+};
+
+//bytes missing from the end of the ArtTrigger data keep the default in g_effectdefaults
+struct SEffectParams
+{
+  uint8_t Color1[3]; //rgb
+  uint8_t Color2[3];
+  uint8_t Speed;
+  uint8_t Size;
+} __attribute__((packed));
+
+//the leds are numbered across nodes, starting at firstled, so effects run on from one node to the next,
+//in PALETTE builds a led is a palette index, the effects write the mix of Color2 and Color1 as an index from 0 to 255,
+//and the hue for EffectRainbow, so the palette gives the colors
+class CEffects
+{
+  public:
+    CEffects() : m_effect(EffectNone) {}
+
+    bool Start(uint8_t effect, const uint8_t* data, uint16_t len, uint32_t now);
+    void Stop()         { m_effect = EffectNone;        }
+    bool Active() const { return m_effect != EffectNone; }
+    void Render(CLed* leds, uint16_t numleds, uint32_t firstled, uint32_t now);
+
+  private:
+    uint32_t Phase(uint32_t now);
+    void     SetLed(CLed& led, uint8_t level);
+    void     SetHue(CLed& led, uint8_t hue);
+
+    uint8_t       m_effect;
+    SEffectParams m_params;
+    uint32_t      m_starttime;
+};
+
+#endif //EFFECTS_H
@@ -0,0 +1,109 @@
+#ifndef HAL_H
+#define HAL_H
+
+//hardware abstraction layer
+//CController, CArtNet and CSacn only talk to the network, the leds and the watchdog through these functions,
+//hal_avr.cpp implements them for the ATmega with ENC28J60 and FastSPI_LED2,
+//host/hal_linux.cpp implements them for a Linux process with UDP sockets and a memory mapped led file
+
+#ifdef __AVR__
+#include <Arduino.h>
+#include <FastSPI_LED2.h>
+#else
+#include "host/host.h"
+#endif
+
+//same signature as the EtherCard udp server callback,
+//ip points into the receive buffer, it's only valid until the next packet is sent
+typedef void (*HalUdpCallback)(uint16_t port, uint8_t ip[4], const char* data, uint16_t len);
+
+//number of payload bytes read from a udp packet before its classifier is called
+#define HALPEEKSIZE 18
+
+//set to 0 to leave out the sACN receiver, see sacn.h
+#ifndef SACN
+#define SACN 1
+#endif
+
+//bytes of the buffer a packet is received into, with the ethernet, ip and udp headers, and a terminator,
+//ArtDmx with 512 channels fits in 600 bytes, E1.31 has a 108 bytes longer header
+#define HALBUFFERSIZE (SACN ? 681 : 600)
+
+//called with the first peeklen bytes of the len payload bytes of a received udp packet,
+//before the rest of it is read from the network controller,
+//returns how many payload bytes the callback needs, 0 drops the packet,
+//the callback is still passed the full length of the payload, bytes after the needed ones are not valid
+typedef uint16_t (*HalUdpClassifier)(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len);
+
+//bytes of EEPROM in the ATmega328P
+#define HALEEPROMSIZE 1024
+
+//puts a variable in RAM that isn't cleared at startup, so it keeps its value over a watchdog reset,
+//after power up it holds random data
+#ifdef __AVR__
+#define HALNOINIT __attribute__((section(".noinit")))
+#else
+#define HALNOINIT __attribute__((section("noinit")))
+#endif
+
+enum LedType
+{
+  LedStrip, //WS2812B led strip
+  LedPixel, //WS2801 led pixels
+};
+
+void     HalWatchdogSetup();
+void     HalWatchdogReset();
+
+bool     HalNetBegin(const uint8_t* mac);
+void     HalNetEnableBroadcast();
+//receive only unicast packets, and broadcast udp packets to port
+//with payload bytes matching pattern, where bit n of mask selects payload byte n
+//HalNetEnableBroadcast() receives all broadcast packets again
+void     HalNetFilterBroadcast(uint16_t port, const uint8_t* pattern, uint16_t mask);
+//receives the ipv4 multicast group as well, and sends an IGMP membership report for it,
+//the network controller filters on a hash of the group, so packets of other groups can get through
+void     HalNetJoinMulticast(const uint8_t* group);
+//stops receiving all multicast groups, no IGMP leave is sent, switches stop forwarding them after the next query
+void     HalNetLeaveMulticast();
+//true when an IGMP membership query was received, the groups are reported again by joining them
+bool     HalNetMulticastQueried();
+void     HalNetClearMulticastQueried();
+//true when the packet passed to the udp callback was sent to a broadcast address
+bool     HalNetReceivedBroadcast();
+//true when the ethernet link is up
+bool     HalNetLinkUp();
+bool     HalNetDhcpSetup();
+void     HalNetStaticSetup(const uint8_t* ip, const uint8_t* gw);
+//uses a lease from before a reset straight away, without waiting for the link,
+//DHCP confirms or renews it in the background of HalNetPoll(), which makes HalNetDhcpRenewed() true once it's bound,
+//the address stays in use until the DHCP server refuses it
+void     HalNetLeaseSetup(const uint8_t* ip, const uint8_t* mask, const uint8_t* gw);
+bool     HalNetDhcpRenewed();
+void     HalNetClearDhcpRenewed();
+uint8_t* HalNetIp();
+uint8_t* HalNetMask();
+uint8_t* HalNetGateway();
+uint8_t* HalNetDns();
+uint8_t* HalNetMac();
+uint8_t* HalNetTransmitBuffer();
+void     HalNetListen(uint16_t port, HalUdpCallback callback, HalUdpClassifier classifier = NULL);
+//handles a received packet, returns true if there was one, also when it was dropped
+bool     HalNetPoll();
+void     HalNetTransmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport);
+//true while the previous packet is still being transmitted
+bool     HalNetTransmitBusy();
+//number of received packets waiting to be handled by HalNetPoll()
+uint8_t  HalNetReceivePending();
+
+//reads and writes the EEPROM, writing only touches bytes that change, each takes about 3.3 ms on the ATmega
+void     HalEepromRead(uint16_t address, uint8_t* data, uint16_t len);
+void     HalEepromWrite(uint16_t address, const uint8_t* data, uint16_t len);
+
+LedType  HalLedsInitialize(CRGB* leds, uint16_t numleds);
+void     HalLedsShow(const CRGB* leds, uint16_t numleds);
+//sends the colors palette[leds[n] & (palettesize - 1)], palettesize must be a power of two,
+//without expanding the leds in RAM first
+void     HalLedsShowPalette(const uint8_t* leds, const CRGB* palette, uint16_t palettesize, uint16_t numleds);
+
+#endif //HAL_H
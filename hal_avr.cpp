@@ -0,0 +1,773 @@
+#ifdef __AVR__
+
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <EtherCard.h>
+#include "hal.h"
+#include "dhcp.h"
+
+byte Ethernet::buffer[HALBUFFERSIZE];
+
+#define DATAPIN 1
+#define CLOCKPIN 4
+#define SELECTPIN 6
+#define ETHERRESETPIN 9
+#define ETHERSELECTPIN 8
+
+//led data on pin 1, which is PD1, and led clock on pin 4, which is PD4, for HalLedsShowPalette()
+#define LED_DATABIT  _BV(PD1)
+#define LED_CLOCKBIT _BV(PD4)
+
+//ENC28J60 chip select on pin 8, which is PB0
+#define ENC_SELECT()   (PORTB &= ~_BV(PB0))
+#define ENC_DESELECT() (PORTB |= _BV(PB0))
+
+//ENC28J60 spi opcodes
+#define ENC_RCR 0x00
+#define ENC_RBM 0x3A
+#define ENC_WCR 0x40
+#define ENC_BFS 0x80
+#define ENC_BFC 0xA0
+
+//ENC28J60 registers, bits 5 and 6 hold the bank
+#define ENC_ERDPTL  0x00
+#define ENC_ERXSTL  0x08
+#define ENC_ERXNDL  0x0A
+#define ENC_ERXRDPTL 0x0C
+#define ENC_EHT0    (0x00 | 0x20)
+#define ENC_EPMM0   (0x08 | 0x20)
+#define ENC_EPMCSL  (0x10 | 0x20)
+#define ENC_EPMCSH  (0x11 | 0x20)
+#define ENC_EPMOL   (0x14 | 0x20)
+#define ENC_EPMOH   (0x15 | 0x20)
+#define ENC_ERXFCON (0x18 | 0x20)
+#define ENC_EPKTCNT (0x19 | 0x20)
+#define ENC_ECON2   0x1E
+#define ENC_ECON1   0x1F
+
+#define ECON1_TXRTS  0x08
+#define ECON2_PKTDEC 0x40
+
+#define ERXFCON_UCEN  0x80
+#define ERXFCON_CRCEN 0x20
+#define ERXFCON_PMEN  0x10
+#define ERXFCON_HTEN  0x04
+
+//offsets in the ethernet frame
+#define IP_PROTO_OFFSET     23
+#define IP_SRC_OFFSET       26
+#define IP_DST_OFFSET       30
+#define UDP_DST_PORT_OFFSET 36
+
+#define IP_PROTO_IGMP 2
+#define IP_PROTO_UDP  17
+
+#define IGMP_QUERY    0x11
+#define IGMP_REPORTV2 0x16
+
+//an IGMPv2 report, ip header with the router alert option, and the IGMP message
+#define IGMP_REPORT_SIZE (14 + 24 + 8)
+
+#define MAXLISTENERS 4
+
+struct SListener
+{
+  uint16_t         port;
+  HalUdpCallback   callback;
+  HalUdpClassifier classifier;
+};
+
+static CLEDController* g_ledcontroller;
+static LedType         g_ledtype;
+static SListener       g_listeners[MAXLISTENERS];
+static uint8_t         g_numlisteners;
+static uint16_t        g_rxstart;
+static uint16_t        g_rxend;
+static uint16_t        g_nextpacket;
+static uint8_t         g_hashtable[8]; //EHT0 to EHT7, the multicast hash filter
+static uint8_t         g_hashfilter;   //ERXFCON_HTEN when a group is joined
+static bool            g_queried;
+static bool            g_rebooting;    //confirming the stored lease, see dhcp.h
+static uint32_t        g_rebootxid;
+static uint32_t        g_reboottime;   //when the next DHCPREQUEST is sent
+static uint8_t         g_reboottries;  //unanswered requests
+
+static uint8_t EncSpi(uint8_t data)
+{
+  SPDR = data;
+  while (!(SPSR & _BV(SPIF)));
+  return SPDR;
+}
+
+static void EncWriteOp(uint8_t op, uint8_t address, uint8_t data)
+{
+  ENC_SELECT();
+  EncSpi(op | (address & 0x1F));
+  EncSpi(data);
+  ENC_DESELECT();
+}
+
+static uint8_t EncReadOp(uint8_t op, uint8_t address)
+{
+  ENC_SELECT();
+  EncSpi(op | (address & 0x1F));
+  uint8_t data = EncSpi(0);
+  ENC_DESELECT();
+  return data;
+}
+
+//EtherCard remembers which register bank is selected,
+//so the bank is put back after accessing registers in another one
+static uint8_t EncGetBank()
+{
+  return EncReadOp(ENC_RCR, ENC_ECON1) & 0x03;
+}
+
+static void EncSetBank(uint8_t address)
+{
+  EncWriteOp(ENC_BFC, ENC_ECON1, 0x03);
+  EncWriteOp(ENC_BFS, ENC_ECON1, (address >> 5) & 0x03);
+}
+
+static uint16_t EncReadReg16(uint8_t address)
+{
+  return EncReadOp(ENC_RCR, address) | ((uint16_t)EncReadOp(ENC_RCR, address + 1) << 8);
+}
+
+static void EncWriteReg16(uint8_t address, uint16_t data)
+{
+  EncWriteOp(ENC_WCR, address, data & 0xFF);
+  EncWriteOp(ENC_WCR, address + 1, data >> 8);
+}
+
+//sets and clears bits of ERXFCON, the bit field set and clear opcodes work on the ETH registers
+static void EncSetFilterBits(uint8_t bits)
+{
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_ERXFCON);
+  EncWriteOp(ENC_BFS, ENC_ERXFCON, bits);
+  EncSetBank(bank << 5);
+}
+
+static void EncClearFilterBits(uint8_t bits)
+{
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_ERXFCON);
+  EncWriteOp(ENC_BFC, ENC_ERXFCON, bits);
+  EncSetBank(bank << 5);
+}
+
+static void EncReadBuffer(uint8_t* data, uint16_t len)
+{
+  ENC_SELECT();
+  EncSpi(ENC_RBM);
+  while (len--)
+    *data++ = EncSpi(0);
+  ENC_DESELECT();
+}
+
+//EtherCard receives packets itself while it's setting up dhcp,
+//continue after the last packet it freed
+static void EncSyncReceive()
+{
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_ERXSTL);
+  g_rxstart = EncReadReg16(ENC_ERXSTL);
+  g_rxend = EncReadReg16(ENC_ERXNDL);
+  uint16_t readpointer = EncReadReg16(ENC_ERXRDPTL);
+  if (readpointer == g_rxstart || readpointer == g_rxend)
+    g_nextpacket = g_rxstart;
+  else
+    g_nextpacket = readpointer + 1;
+  EncSetBank(bank << 5);
+}
+
+static SListener* FindListener(const uint8_t* packet)
+{
+  //ipv4 without options, carrying udp
+  if (packet[12] != 0x08 || packet[13] != 0x00 || packet[14] != 0x45 || packet[IP_PROTO_OFFSET] != IP_PROTO_UDP)
+    return NULL;
+
+  uint16_t port = ((uint16_t)packet[UDP_DST_PORT_OFFSET] << 8) | packet[UDP_DST_PORT_OFFSET + 1];
+  for (uint8_t i = 0; i < g_numlisteners; i++)
+  {
+    if (g_listeners[i].port == port)
+      return g_listeners + i;
+  }
+
+  return NULL;
+}
+
+static uint16_t UdpPayloadLen(const uint8_t* packet)
+{
+  return (((uint16_t)packet[UDP_DST_PORT_OFFSET + 2] << 8) | packet[UDP_DST_PORT_OFFSET + 3]) - 8;
+}
+
+//reads the next packet into the EtherCard buffer, bank 0 has to be selected,
+//the headers and the first bytes of the udp payload are read first,
+//the classifier of the udp port then decides how much of the rest is needed
+static uint16_t EncReceive()
+{
+  uint8_t header[6]; //next packet pointer, byte count, status
+  EncWriteReg16(ENC_ERDPTL, g_nextpacket);
+  EncReadBuffer(header, sizeof(header));
+  g_nextpacket = header[0] | ((uint16_t)header[1] << 8);
+
+  //same as EtherCard, strip the crc and cut off what doesn't fit
+  uint16_t len = (header[2] | ((uint16_t)header[3] << 8)) - 4;
+  if (len > sizeof(Ethernet::buffer) - 1)
+    len = sizeof(Ethernet::buffer) - 1;
+  if (!(header[4] & 0x80))
+    len = 0;
+
+  uint16_t readlen = min(len, UDP_DATA_P + HALPEEKSIZE);
+  EncReadBuffer(Ethernet::buffer, readlen);
+
+  SListener* listener = readlen > UDP_DATA_P ? FindListener(Ethernet::buffer) : NULL;
+  if (listener && listener->classifier)
+  {
+    uint16_t needed = listener->classifier(listener->port, Ethernet::buffer + UDP_DATA_P, readlen - UDP_DATA_P,
+                                           UdpPayloadLen(Ethernet::buffer));
+    len = needed ? min(len, UDP_DATA_P + needed) : 0;
+  }
+
+  if (len > readlen)
+    EncReadBuffer(Ethernet::buffer + readlen, len - readlen);
+  Ethernet::buffer[len] = 0;
+
+  //free the packet memory, ERXRDPT has to be odd because of the ENC28J60 errata
+  if ((uint16_t)(g_nextpacket - 1) > g_rxend)
+    EncWriteReg16(ENC_ERXRDPTL, g_rxend);
+  else
+    EncWriteReg16(ENC_ERXRDPTL, g_nextpacket - 1);
+  EncWriteOp(ENC_BFS, ENC_ECON2, ECON2_PKTDEC);
+
+  return len;
+}
+
+void HalWatchdogSetup()
+{
+  //the WDTON fuse should be programmed to 0 in the high fuse byte,
+  //to make the watchdog timer permanently enabled
+  //here the watchdog timer is set to the comfortable timeout of 8 seconds
+  cli();
+  wdt_reset();
+  wdt_enable(WDTO_8S);
+  sei();
+}
+
+void HalWatchdogReset()
+{
+  wdt_reset();
+}
+
+bool HalNetBegin(const uint8_t* mac)
+{
+  //make the reset pin low to reset the ENC28J60, it needs 400 ns,
+  //ether.begin() waits for its oscillator to start after that
+  pinMode(ETHERRESETPIN, OUTPUT);
+  digitalWrite(ETHERRESETPIN, LOW);
+  delay(1);
+  digitalWrite(ETHERRESETPIN, HIGH);
+  delay(1);
+
+  wdt_reset();
+  if (ether.begin(sizeof(Ethernet::buffer), (uint8_t*)mac, ETHERSELECTPIN) == 0)
+    return false;
+
+  EncSyncReceive();
+  return true;
+}
+
+void HalNetEnableBroadcast()
+{
+  ether.enableBroadcast();
+  if (g_hashfilter)
+    EncSetFilterBits(g_hashfilter);
+}
+
+void HalNetFilterBroadcast(uint16_t port, const uint8_t* pattern, uint16_t mask)
+{
+  //the pattern match window starts at the udp destination port, the payload starts 6 bytes later
+  //the ENC28J60 compares an ip style checksum of the selected bytes with EPMCS
+  uint8_t  window[2 + 16];
+  uint8_t  windowsize = 0;
+  uint32_t windowmask = 0x03 | ((uint32_t)mask << 6);
+  window[windowsize++] = port >> 8;
+  window[windowsize++] = port & 0xFF;
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    if (mask & (1 << i))
+      window[windowsize++] = pattern[i];
+  }
+
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < windowsize; i += 2)
+    sum += ((uint16_t)window[i] << 8) | (i + 1 < windowsize ? window[i + 1] : 0);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  uint16_t checksum = ~sum;
+
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_ERXFCON);
+  for (uint8_t i = 0; i < 8; i++)
+    EncWriteOp(ENC_WCR, ENC_EPMM0 + i, i < 4 ? windowmask >> (i * 8) : 0);
+  EncWriteOp(ENC_WCR, ENC_EPMCSL, checksum & 0xFF);
+  EncWriteOp(ENC_WCR, ENC_EPMCSH, checksum >> 8);
+  EncWriteOp(ENC_WCR, ENC_EPMOL, UDP_DST_PORT_OFFSET);
+  EncWriteOp(ENC_WCR, ENC_EPMOH, 0);
+  EncWriteOp(ENC_WCR, ENC_ERXFCON, ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_PMEN | g_hashfilter);
+  EncSetBank(bank << 5);
+}
+
+//the ENC28J60 hashes the destination mac address with the ethernet crc,
+//bits 28 to 23 select a bit of EHT0 to EHT7
+static uint8_t HashIndex(const uint8_t* mac)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    uint8_t data = mac[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      bool feedback = ((crc >> 31) ^ data) & 1;
+      crc <<= 1;
+      if (feedback)
+        crc ^= 0x04C11DB7;
+      data >>= 1;
+    }
+  }
+
+  return (crc >> 23) & 0x3F;
+}
+
+static void HashAdd(const uint8_t* mac)
+{
+  uint8_t index = HashIndex(mac);
+  g_hashtable[index >> 3] |= 1 << (index & 7);
+}
+
+static uint16_t IpChecksum(const uint8_t* data, uint8_t len)
+{
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < len; i += 2)
+    sum += ((uint16_t)data[i] << 8) | data[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+  return ~sum;
+}
+
+//sends an IGMPv2 membership report for group, from the EtherCard buffer
+static void SendIgmpReport(const uint8_t* group)
+{
+  static const uint8_t header[] PROGMEM =
+  {
+    0x08, 0x00,                         //ipv4
+    0x46, 0xC0, 0x00, 24 + 8,           //header with one option word, internetwork control, total length
+    0x00, 0x00, 0x00, 0x00,             //identification, fragment
+    0x01, IP_PROTO_IGMP, 0x00, 0x00,    //ttl 1, protocol, checksum
+  };
+
+  uint8_t* packet = Ethernet::buffer;
+  memset(packet, 0, IGMP_REPORT_SIZE);
+  packet[0] = 0x01;
+  packet[1] = 0x00;
+  packet[2] = 0x5E;
+  packet[3] = group[1] & 0x7F;
+  packet[4] = group[2];
+  packet[5] = group[3];
+  memcpy(packet + 6, ether.mymac, 6);
+  memcpy_P(packet + 12, header, sizeof(header));
+  memcpy(packet + IP_SRC_OFFSET, ether.myip, 4);
+  memcpy(packet + IP_DST_OFFSET, group, 4);
+  packet[34] = 0x94; //router alert
+  packet[35] = 0x04;
+
+  uint16_t checksum = IpChecksum(packet + 14, 24);
+  packet[24] = checksum >> 8;
+  packet[25] = checksum & 0xFF;
+
+  uint8_t* igmp = packet + 38;
+  igmp[0] = IGMP_REPORTV2;
+  memcpy(igmp + 4, group, 4);
+  checksum = IpChecksum(igmp, 8);
+  igmp[2] = checksum >> 8;
+  igmp[3] = checksum & 0xFF;
+
+  ether.packetSend(IGMP_REPORT_SIZE);
+}
+
+static void EncWriteHashTable()
+{
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_EHT0);
+  for (uint8_t i = 0; i < sizeof(g_hashtable); i++)
+    EncWriteOp(ENC_WCR, ENC_EHT0 + i, g_hashtable[i]);
+  EncSetBank(bank << 5);
+}
+
+void HalNetJoinMulticast(const uint8_t* group)
+{
+  //queries to all hosts on 224.0.0.1 are received with the groups
+  static const uint8_t allhosts[6] PROGMEM = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0x01 };
+  uint8_t mac[6];
+  memcpy_P(mac, allhosts, sizeof(mac));
+  HashAdd(mac);
+  mac[3] = group[1] & 0x7F;
+  mac[4] = group[2];
+  mac[5] = group[3];
+  HashAdd(mac);
+  EncWriteHashTable();
+
+  g_hashfilter = ERXFCON_HTEN;
+  EncSetFilterBits(g_hashfilter);
+
+  SendIgmpReport(group);
+}
+
+void HalNetLeaveMulticast()
+{
+  memset(g_hashtable, 0, sizeof(g_hashtable));
+  EncWriteHashTable();
+  g_hashfilter = 0;
+  EncClearFilterBits(ERXFCON_HTEN);
+}
+
+bool HalNetMulticastQueried()
+{
+  return g_queried;
+}
+
+void HalNetClearMulticastQueried()
+{
+  g_queried = false;
+}
+
+bool HalNetLinkUp()
+{
+  return ether.isLinkUp();
+}
+
+bool HalNetDhcpSetup()
+{
+  bool result = ether.dhcpSetup();
+  EncSyncReceive();
+  return result;
+}
+
+void HalNetStaticSetup(const uint8_t* ip, const uint8_t* gw)
+{
+  ether.staticSetup((uint8_t*)ip, (uint8_t*)gw);
+}
+
+void HalNetLeaseSetup(const uint8_t* ip, const uint8_t* mask, const uint8_t* gw)
+{
+  ether.staticSetup((uint8_t*)ip, (uint8_t*)gw);
+  memcpy(ether.mymask, mask, 4);
+
+  //the EtherCard DHCP state machine would start from INIT, which clears the address and sends a DHCPDISCOVER,
+  //so HalNetPoll() confirms the lease with a DHCPREQUEST from INIT-REBOOT instead
+  g_rebooting = true;
+  g_reboottries = 0;
+  g_reboottime = millis();
+}
+
+//sends a DHCPREQUEST for the address in use
+static void DhcpRebootSend()
+{
+  static uint8_t broadcastip[4] = { 255, 255, 255, 255 };
+
+  g_rebootxid = micros() ^ ((uint32_t)ether.mymac[4] << 24) ^ ((uint32_t)ether.mymac[5] << 16);
+  ether.udpPrepare(DHCPCLIENTPORT, broadcastip, DHCPSERVERPORT);
+  uint16_t len = DhcpRebootRequest(Ethernet::buffer + UDP_DATA_P, ether.mymac, ether.myip, g_rebootxid);
+  //a client in INIT-REBOOT sends from 0.0.0.0, udpTransmit() calculates the checksums after this
+  memset(Ethernet::buffer + IP_SRC_OFFSET, 0, 4);
+  ether.udpTransmit(len);
+
+  g_reboottries++;
+  g_reboottime = millis() + (g_reboottries < DHCPREBOOTTRIES ? DHCPREBOOTINTERVAL : DHCPREBOOTRETRY);
+}
+
+//handles a reply to the DHCPREQUEST, returns true if the packet was one
+static bool DhcpRebootReceive(uint16_t len)
+{
+  uint8_t* packet = Ethernet::buffer;
+  if (len <= UDP_DATA_P || packet[12] != 0x08 || packet[13] != 0x00 || packet[14] != 0x45 ||
+      packet[IP_PROTO_OFFSET] != IP_PROTO_UDP ||
+      (((uint16_t)packet[UDP_DST_PORT_OFFSET] << 8) | packet[UDP_DST_PORT_OFFSET + 1]) != DHCPCLIENTPORT)
+    return false;
+
+  SDhcpLease lease;
+  memcpy(lease.Ip, ether.myip, 4);
+  memcpy(lease.Mask, ether.mymask, 4);
+  memcpy(lease.Gateway, ether.gwip, 4);
+  memcpy(lease.Dns, ether.dnsip, 4);
+  lease.LeaseTime = DHCPMAXLEASE;
+
+  uint8_t type = DhcpParseReply(packet + UDP_DATA_P, min((uint16_t)(len - UDP_DATA_P), UdpPayloadLen(packet)), ether.mymac,
+                                g_rebootxid, &lease);
+  if (type == DhcpAck)
+  {
+    //confirm the lease again at half its time, but not more often than an unanswered request is repeated
+    ether.staticSetup(lease.Ip, lease.Gateway);
+    memcpy(ether.mymask, lease.Mask, 4);
+    memcpy(ether.dnsip, lease.Dns, 4);
+    g_reboottries = 0;
+    g_reboottime = millis() + max(min(lease.LeaseTime, DHCPMAXLEASE) / 2 * 1000, DHCPREBOOTRETRY);
+    EtherCard::dhcp_renewed = true;
+  }
+  else if (type == DhcpNak)
+  {
+    //the address can't be used anymore, get a new lease the usual way,
+    //packetLoop() runs the EtherCard DHCP state machine from INIT when this is set, dhcp_renewed is set when it's bound
+    g_rebooting = false;
+    EtherCard::using_dhcp = true;
+  }
+
+  return true;
+}
+
+bool HalNetDhcpRenewed()
+{
+  return EtherCard::dhcp_renewed;
+}
+
+void HalNetClearDhcpRenewed()
+{
+  EtherCard::dhcp_renewed = false;
+}
+
+uint8_t* HalNetIp()
+{
+  return ether.myip;
+}
+
+uint8_t* HalNetMask()
+{
+  return ether.mymask;
+}
+
+uint8_t* HalNetGateway()
+{
+  return ether.gwip;
+}
+
+uint8_t* HalNetDns()
+{
+  return ether.dnsip;
+}
+
+uint8_t* HalNetMac()
+{
+  return ether.mymac;
+}
+
+uint8_t* HalNetTransmitBuffer()
+{
+  return Ethernet::buffer + UDP_DATA_P;
+}
+
+void HalNetListen(uint16_t port, HalUdpCallback callback, HalUdpClassifier classifier)
+{
+  ether.udpServerListenOnPort(callback, port);
+  if (g_numlisteners < MAXLISTENERS)
+  {
+    g_listeners[g_numlisteners].port = port;
+    g_listeners[g_numlisteners].callback = callback;
+    g_listeners[g_numlisteners].classifier = classifier;
+    g_numlisteners++;
+  }
+}
+
+bool HalNetPoll()
+{
+  //packets are read here instead of with ether.packetReceive(), which always reads the whole packet,
+  //EtherCard then handles them as usual
+  //sent before a packet is received, since it's built in the receive buffer
+  if (g_rebooting && (int32_t)(millis() - g_reboottime) >= 0)
+    DhcpRebootSend();
+
+  //a packet the classifier drops still counts as received, it's traffic the leds shouldn't be shown during
+  uint16_t len = 0;
+  bool received = false;
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_EPKTCNT);
+  if (EncReadOp(ENC_RCR, ENC_EPKTCNT) > 0)
+  {
+    EncSetBank(ENC_ERDPTL);
+    len = EncReceive();
+    received = true;
+  }
+  EncSetBank(bank << 5);
+
+  //EtherCard only handles udp for its own address, multicast udp is passed to the listener here,
+  //an IGMP query makes the groups get reported again
+  uint8_t* packet = Ethernet::buffer;
+  if (g_rebooting && DhcpRebootReceive(len))
+  {
+    len = 0;
+  }
+  else if (len > UDP_DATA_P && packet[0] == 0x01 && packet[IP_DST_OFFSET] >= 224 && packet[IP_DST_OFFSET] <= 239)
+  {
+    SListener* listener = FindListener(packet);
+    if (listener)
+      listener->callback(listener->port, packet + IP_SRC_OFFSET, (const char*)packet + UDP_DATA_P, UdpPayloadLen(packet));
+    len = 0;
+  }
+  else if (len > UDP_DATA_P && packet[12] == 0x08 && packet[13] == 0x00 && packet[IP_PROTO_OFFSET] == IP_PROTO_IGMP &&
+           packet[14 + (packet[14] & 0x0F) * 4] == IGMP_QUERY)
+  {
+    g_queried = true;
+    len = 0;
+  }
+
+  ether.packetLoop(len);
+  return received;
+}
+
+bool HalNetReceivedBroadcast()
+{
+  //the destination mac address of the packet still in the buffer
+  return Ethernet::buffer[0] == 0xFF;
+}
+
+void HalNetTransmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport)
+{
+  ether.sendUdp((char*)data, size, sourceport, (uint8_t*)destip, destport);
+}
+
+bool HalNetTransmitBusy()
+{
+  return EncReadOp(ENC_RCR, ENC_ECON1) & ECON1_TXRTS;
+}
+
+uint8_t HalNetReceivePending()
+{
+  uint8_t bank = EncGetBank();
+  EncSetBank(ENC_EPKTCNT);
+  uint8_t packets = EncReadOp(ENC_RCR, ENC_EPKTCNT);
+  EncSetBank(bank << 5);
+  return packets;
+}
+
+void HalEepromRead(uint16_t address, uint8_t* data, uint16_t len)
+{
+  eeprom_read_block(data, (const void*)address, len);
+}
+
+void HalEepromWrite(uint16_t address, const uint8_t* data, uint16_t len)
+{
+  eeprom_update_block(data, (void*)address, len);
+}
+
+LedType HalLedsInitialize(CRGB* leds, uint16_t numleds)
+{
+  //make the pixel/strip pin an input, and enable the internal pullup
+  pinMode(SELECTPIN, INPUT);
+  digitalWrite(SELECTPIN, HIGH);
+  //let the pin rise if the jumper is open
+  delay(10);
+
+  //add led chip based on jumper position
+  if (digitalRead(SELECTPIN))
+  {
+    g_ledcontroller = LEDS.addLeds<WS2812B, DATAPIN, GRB>(leds, numleds); //led strip
+    g_ledtype = LedStrip;
+  }
+  else
+  {
+    g_ledcontroller = LEDS.addLeds<WS2801, DATAPIN, CLOCKPIN, BRG>(leds, numleds); //led pixel
+    g_ledtype = LedPixel;
+  }
+
+  return g_ledtype;
+}
+
+void HalLedsShow(const CRGB* leds, uint16_t numleds)
+{
+  g_ledcontroller->show(leds, numleds);
+}
+
+//sends one byte to a WS2812B on the data pin at 16 MHz, msb first,
+//every bit takes 20 cycles, it's high for 6 cycles for a 0 and for 13 cycles for a 1
+static inline void __attribute__((always_inline)) Ws2812SendByte(uint8_t data, uint8_t hi, uint8_t lo)
+{
+  uint8_t bits;
+  asm volatile(
+    "      ldi  %[bits], 8     \n\t"
+    "1:    out  %[port], %[hi] \n\t" //0
+    "      nop                 \n\t" //1
+    "      nop                 \n\t" //2
+    "      nop                 \n\t" //3
+    "      nop                 \n\t" //4
+    "      sbrs %[data], 7     \n\t" //5, skips the next out for a 1
+    "      out  %[port], %[lo] \n\t" //6
+    "      lsl  %[data]        \n\t" //7
+    "      nop                 \n\t" //8
+    "      nop                 \n\t" //9
+    "      nop                 \n\t" //10
+    "      nop                 \n\t" //11
+    "      nop                 \n\t" //12
+    "      out  %[port], %[lo] \n\t" //13
+    "      nop                 \n\t" //14
+    "      nop                 \n\t" //15
+    "      nop                 \n\t" //16
+    "      dec  %[bits]        \n\t" //17
+    "      brne 1b             \n\t" //18 and 19
+    : [bits] "=&d" (bits), [data] "+r" (data)
+    : [port] "I" (_SFR_IO_ADDR(PORTD)), [hi] "r" (hi), [lo] "r" (lo)
+  );
+}
+
+//sends one byte to a WS2801 on the data and clock pins, msb first
+static inline void Ws2801SendByte(uint8_t data)
+{
+  for (uint8_t bit = 0x80; bit; bit >>= 1)
+  {
+    if (data & bit)
+      PORTD |= LED_DATABIT;
+    else
+      PORTD &= ~LED_DATABIT;
+
+    PORTD |= LED_CLOCKBIT;
+    PORTD &= ~LED_CLOCKBIT;
+  }
+}
+
+//the palette lookup between leds only stretches the low time of the last bit,
+//which the WS2812B tolerates well below its reset time, the WS2801 is clocked so timing doesn't matter
+void HalLedsShowPalette(const uint8_t* leds, const CRGB* palette, uint16_t palettesize, uint16_t numleds)
+{
+  uint8_t mask = palettesize - 1;
+  const uint8_t* end = leds + numleds;
+
+  if (g_ledtype == LedStrip)
+  {
+    uint8_t hi = PORTD | LED_DATABIT;
+    uint8_t lo = PORTD & ~LED_DATABIT;
+
+    uint8_t sreg = SREG;
+    cli();
+    while (leds != end)
+    {
+      const CRGB& color = palette[*leds++ & mask];
+      Ws2812SendByte(color.g, hi, lo);
+      Ws2812SendByte(color.r, hi, lo);
+      Ws2812SendByte(color.b, hi, lo);
+    }
+    SREG = sreg;
+  }
+  else
+  {
+    while (leds != end)
+    {
+      const CRGB& color = palette[*leds++ & mask];
+      Ws2801SendByte(color.b);
+      Ws2801SendByte(color.r);
+      Ws2801SendByte(color.g);
+    }
+  }
+}
+
+#endif //__AVR__
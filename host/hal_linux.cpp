@@ -0,0 +1,630 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "../hal.h"
+
+//same layout as the EtherCard buffer, the udp payload starts after the ethernet, ip and udp headers
+#define UDP_DATA_P 42
+#define MAXLISTENERS 4
+#define MAXGROUPS 16
+#define WATCHDOGTIMEOUT 8000
+//descriptor that passes the HALNOINIT variables to the restarted process
+#define NOINITFD 99
+
+struct SListener
+{
+  int              fd;
+  uint16_t         port;
+  HalUdpCallback   callback;
+  HalUdpClassifier classifier;
+};
+
+//the linker sets these around the section HALNOINIT puts variables in
+extern uint8_t __start_noinit[];
+extern uint8_t __stop_noinit[];
+
+static char**                g_argv;
+static struct timespec       g_starttime;
+static volatile uint32_t     g_watchdogtime;
+static volatile sig_atomic_t g_sighup;
+
+static const char*     g_address;
+static const char*     g_ledfile = "loc_leds.bin";
+static const char*     g_eepromfile = "loc_eeprom.bin";
+static LedType         g_ledtype = LedStrip;
+
+static uint8_t         g_buffer[HALBUFFERSIZE];
+static uint8_t         g_ip[4];
+static uint8_t         g_mask[4];
+static uint8_t         g_gw[4];
+static uint8_t         g_dns[4];
+static uint8_t         g_mac[6];
+static bool            g_dhcprenewed;
+static bool            g_dhcppending; //a stored lease is used until the next HalNetPoll()
+static SListener       g_listeners[MAXLISTENERS];
+static uint8_t         g_numlisteners;
+static bool            g_filter;
+static uint16_t        g_filterport;
+static uint8_t         g_filterpattern[16];
+static uint16_t        g_filtermask;
+static bool            g_broadcast;   //the packet being handled was sent to a broadcast address
+static int             g_multicastfd = -1; //holds the group memberships, the listeners receive the groups through it
+static struct in_addr  g_groups[MAXGROUPS];
+static uint8_t         g_numgroups;
+
+static uint8_t*        g_eeprom;
+static SVirtualStrip*  g_strip;
+static uint16_t        g_numleds;
+
+static void Usage()
+{
+  fprintf(stderr,
+          "usage: %s [-a ip/prefix] [-l ledfile] [-e eepromfile] [-p]\n"
+          "  -a  address and prefix length the node uses, default is the first non loopback interface\n"
+          "  -l  file the leds are rendered into, default %s\n"
+          "  -e  file that holds the EEPROM, default %s\n"
+          "  -p  emulate WS2801 led pixels instead of a WS2812B led strip\n"
+          "send SIGHUP to make the node act as if its DHCP lease was renewed\n",
+          g_argv[0], g_ledfile, g_eepromfile);
+}
+
+static void SigHup(int)
+{
+  g_sighup = 1;
+}
+
+static void WatchdogTimer(int)
+{
+  //restart the process the same way the watchdog resets the board
+  if (millis() - g_watchdogtime >= WATCHDOGTIMEOUT)
+  {
+    static const char msg[] = "watchdog timeout, restarting\n";
+    if (write(STDERR_FILENO, msg, sizeof(msg) - 1)) {}
+
+    //the ATmega keeps its RAM over a watchdog reset, so the HALNOINIT variables are handed over
+    int fd = memfd_create("noinit", 0);
+    if (fd != -1 && write(fd, __start_noinit, __stop_noinit - __start_noinit) != -1)
+      dup2(fd, NOINITFD);
+
+    execv("/proc/self/exe", g_argv);
+    _exit(EXIT_FAILURE);
+  }
+}
+
+void HalHostConfigure(int argc, char* argv[])
+{
+  g_argv = argv;
+
+  //restore the HALNOINIT variables after a watchdog timeout, after a normal start they're 0
+  if (pread(NOINITFD, __start_noinit, __stop_noinit - __start_noinit, 0) != -1)
+    close(NOINITFD);
+  clock_gettime(CLOCK_MONOTONIC, &g_starttime);
+
+  int c;
+  while ((c = getopt(argc, argv, "a:l:e:ph")) != -1)
+  {
+    if (c == 'a')
+      g_address = optarg;
+    else if (c == 'l')
+      g_ledfile = optarg;
+    else if (c == 'e')
+      g_eepromfile = optarg;
+    else if (c == 'p')
+      g_ledtype = LedPixel;
+    else
+    {
+      Usage();
+      exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  signal(SIGHUP, SigHup);
+}
+
+uint32_t millis()
+{
+  return micros() / 1000;
+}
+
+uint32_t micros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - g_starttime.tv_sec) * 1000000 + (now.tv_nsec - g_starttime.tv_nsec) / 1000;
+}
+
+void delay(uint32_t ms)
+{
+  struct timespec remaining = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+  while (nanosleep(&remaining, &remaining) == -1) {}
+}
+
+void HalWatchdogSetup()
+{
+  g_watchdogtime = millis();
+
+  struct sigaction action = {};
+  action.sa_handler = WatchdogTimer;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &action, NULL);
+
+  //SIGALRM is still blocked when the watchdog restarted the process from inside the handler
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGALRM);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+  struct itimerval timer = { { 0, 100000 }, { 0, 100000 } };
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+void HalWatchdogReset()
+{
+  g_watchdogtime = millis();
+}
+
+static bool ParseAddress(const char* str, uint32_t* address, uint32_t* mask)
+{
+  char ip[INET_ADDRSTRLEN];
+  unsigned int prefix = 24;
+  const char* slash = strchr(str, '/');
+  size_t iplen = slash ? (size_t)(slash - str) : strlen(str);
+  if (iplen >= sizeof(ip))
+    return false;
+
+  memcpy(ip, str, iplen);
+  ip[iplen] = 0;
+  if (slash && (sscanf(slash + 1, "%u", &prefix) != 1 || prefix > 32))
+    return false;
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip, &addr) != 1)
+    return false;
+
+  *address = ntohl(addr.s_addr);
+  *mask = prefix ? ~0u << (32 - prefix) : 0;
+  return true;
+}
+
+static bool FindAddress(uint32_t* address, uint32_t* mask)
+{
+  struct ifaddrs* ifaddrs;
+  if (getifaddrs(&ifaddrs) == -1)
+    return false;
+
+  bool found = false;
+  for (struct ifaddrs* ifa = ifaddrs; ifa && !found; ifa = ifa->ifa_next)
+  {
+    if (!ifa->ifa_addr || !ifa->ifa_netmask || ifa->ifa_addr->sa_family != AF_INET)
+      continue;
+    if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK))
+      continue;
+
+    *address = ntohl(((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr);
+    *mask = ntohl(((struct sockaddr_in*)ifa->ifa_netmask)->sin_addr.s_addr);
+    found = true;
+  }
+
+  freeifaddrs(ifaddrs);
+  return found;
+}
+
+static void StoreAddress(uint8_t* dest, uint32_t address)
+{
+  for (uint8_t i = 0; i < 4; i++)
+    dest[i] = address >> (3 - i) * 8;
+}
+
+static bool ResolveAddress()
+{
+  uint32_t address;
+  uint32_t mask;
+  if (g_address ? !ParseAddress(g_address, &address, &mask) : !FindAddress(&address, &mask))
+  {
+    fprintf(stderr, "unable to determine the node address\n");
+    return false;
+  }
+
+  //the gateway and dns server are assumed to be on the first host address
+  StoreAddress(g_ip, address);
+  StoreAddress(g_mask, mask);
+  StoreAddress(g_gw, (address & mask) | 1);
+  StoreAddress(g_dns, (address & mask) | 1);
+  return true;
+}
+
+bool HalNetBegin(const uint8_t* mac)
+{
+  memcpy(g_mac, mac, sizeof(g_mac));
+  return true;
+}
+
+void HalNetEnableBroadcast()
+{
+  //sockets bound to INADDR_ANY receive broadcasts already
+  g_filter = false;
+}
+
+void HalNetFilterBroadcast(uint16_t port, const uint8_t* pattern, uint16_t mask)
+{
+  g_filter = true;
+  g_filterport = port;
+  memcpy(g_filterpattern, pattern, sizeof(g_filterpattern));
+  g_filtermask = mask;
+}
+
+static bool IsBroadcast(const struct in_addr& dest)
+{
+  uint32_t address = ntohl(dest.s_addr);
+  uint32_t ip = ((uint32_t)g_ip[0] << 24) | (g_ip[1] << 16) | (g_ip[2] << 8) | g_ip[3];
+  uint32_t mask = ((uint32_t)g_mask[0] << 24) | (g_mask[1] << 16) | (g_mask[2] << 8) | g_mask[3];
+  return address == INADDR_BROADCAST || address == (ip | ~mask);
+}
+
+//applies the broadcast filter the way the ENC28J60 pattern match does
+static bool FilterAccepts(uint16_t port, const struct in_addr& dest, const uint8_t* data, ssize_t len)
+{
+  if (!g_filter || !IsBroadcast(dest))
+    return true;
+
+  if (port != g_filterport)
+    return false;
+
+  for (uint8_t i = 0; i < sizeof(g_filterpattern); i++)
+  {
+    if ((g_filtermask & (1 << i)) && (i >= len || data[i] != g_filterpattern[i]))
+      return false;
+  }
+
+  return true;
+}
+
+void HalNetJoinMulticast(const uint8_t* group)
+{
+  //the kernel sends the IGMP report
+  struct ip_mreq mreq = {};
+  memcpy(&mreq.imr_multiaddr, group, 4);
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  for (uint8_t i = 0; i < g_numgroups; i++)
+  {
+    if (g_groups[i].s_addr == mreq.imr_multiaddr.s_addr)
+      return;
+  }
+
+  if (g_numgroups == MAXGROUPS)
+    return;
+
+  if (g_multicastfd == -1)
+    g_multicastfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (setsockopt(g_multicastfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+  {
+    fprintf(stderr, "unable to join multicast group %u.%u.%u.%u: %s\n", group[0], group[1], group[2], group[3], strerror(errno));
+    return;
+  }
+
+  g_groups[g_numgroups++] = mreq.imr_multiaddr;
+}
+
+void HalNetLeaveMulticast()
+{
+  for (uint8_t i = 0; i < g_numgroups; i++)
+  {
+    struct ip_mreq mreq = {};
+    mreq.imr_multiaddr = g_groups[i];
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(g_multicastfd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+  }
+  g_numgroups = 0;
+}
+
+bool HalNetMulticastQueried()
+{
+  //the kernel answers IGMP queries
+  return false;
+}
+
+void HalNetClearMulticastQueried()
+{
+}
+
+bool HalNetLinkUp()
+{
+  return true;
+}
+
+bool HalNetDhcpSetup()
+{
+  return ResolveAddress();
+}
+
+void HalNetStaticSetup(const uint8_t* ip, const uint8_t* gw)
+{
+  memcpy(g_ip, ip, sizeof(g_ip));
+  memcpy(g_gw, gw, sizeof(g_gw));
+  memcpy(g_dns, gw, sizeof(g_dns));
+  StoreAddress(g_mask, 0xFFFFFF00);
+}
+
+void HalNetLeaseSetup(const uint8_t* ip, const uint8_t* mask, const uint8_t* gw)
+{
+  memcpy(g_ip, ip, sizeof(g_ip));
+  memcpy(g_mask, mask, sizeof(g_mask));
+  memcpy(g_gw, gw, sizeof(g_gw));
+  memcpy(g_dns, gw, sizeof(g_dns));
+  g_dhcppending = true;
+}
+
+bool HalNetDhcpRenewed()
+{
+  return g_dhcprenewed;
+}
+
+void HalNetClearDhcpRenewed()
+{
+  g_dhcprenewed = false;
+}
+
+uint8_t* HalNetIp()
+{
+  return g_ip;
+}
+
+uint8_t* HalNetMask()
+{
+  return g_mask;
+}
+
+uint8_t* HalNetGateway()
+{
+  return g_gw;
+}
+
+uint8_t* HalNetDns()
+{
+  return g_dns;
+}
+
+uint8_t* HalNetMac()
+{
+  return g_mac;
+}
+
+uint8_t* HalNetTransmitBuffer()
+{
+  return g_buffer + UDP_DATA_P;
+}
+
+void HalNetListen(uint16_t port, HalUdpCallback callback, HalUdpClassifier classifier)
+{
+  if (g_numlisteners == MAXLISTENERS)
+  {
+    fprintf(stderr, "too many udp listeners\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+  setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+  {
+    fprintf(stderr, "unable to listen on udp port %u: %s\n", port, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  g_listeners[g_numlisteners].fd = fd;
+  g_listeners[g_numlisteners].port = port;
+  g_listeners[g_numlisteners].callback = callback;
+  g_listeners[g_numlisteners].classifier = classifier;
+  g_numlisteners++;
+}
+
+bool HalNetPoll()
+{
+  //the background DHCP of a stored lease, and SIGHUP, take the address from -a or the interface again
+  if (g_sighup || g_dhcppending)
+  {
+    g_sighup = 0;
+    g_dhcppending = false;
+    g_dhcprenewed = ResolveAddress();
+  }
+
+  struct pollfd fds[MAXLISTENERS];
+  for (uint8_t i = 0; i < g_numlisteners; i++)
+  {
+    fds[i].fd = g_listeners[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  if (poll(fds, g_numlisteners, 1) <= 0)
+    return false;
+
+  for (uint8_t i = 0; i < g_numlisteners; i++)
+  {
+    if (!(fds[i].revents & POLLIN))
+      continue;
+
+    struct sockaddr_in from;
+    uint8_t* data = g_buffer + UDP_DATA_P;
+    //like EtherCard, keep one byte free for a terminator after the packet
+    struct iovec iov = { data, sizeof(g_buffer) - UDP_DATA_P - 1 };
+    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    struct msghdr msg = {};
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t len = recvmsg(fds[i].fd, &msg, MSG_TRUNC);
+
+    //like the ENC28J60, drop packets that don't fit in the buffer
+    if (len < 0 || (size_t)len > sizeof(g_buffer) - UDP_DATA_P - 1)
+      continue;
+    data[len] = 0;
+
+    g_broadcast = false;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+    {
+      struct in_pktinfo* pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
+      if (!FilterAccepts(g_listeners[i].port, pktinfo->ipi_addr, data, len))
+        continue;
+      g_broadcast = IsBroadcast(pktinfo->ipi_addr);
+    }
+
+    //the datagram was already read completely, but the classifier is called the same way as on the ENC28J60
+    if (g_listeners[i].classifier && g_listeners[i].classifier(g_listeners[i].port, data, min(len, HALPEEKSIZE), len) == 0)
+      continue;
+
+    uint8_t ip[4];
+    memcpy(ip, &from.sin_addr, sizeof(ip));
+    g_listeners[i].callback(g_listeners[i].port, ip, (const char*)data, len);
+  }
+
+  return true;
+}
+
+void HalNetTransmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport)
+{
+  if (g_numlisteners == 0)
+    return;
+
+  //send from the socket bound to the source port, or the first one if there is none
+  int fd = g_listeners[0].fd;
+  for (uint8_t i = 0; i < g_numlisteners; i++)
+  {
+    if (g_listeners[i].port == sourceport)
+      fd = g_listeners[i].fd;
+  }
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(destport);
+  memcpy(&addr.sin_addr, destip, 4);
+  sendto(fd, data, size, 0, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+bool HalNetReceivedBroadcast()
+{
+  return g_broadcast;
+}
+
+bool HalNetTransmitBusy()
+{
+  //sendto() returns when the packet is queued in the kernel
+  return false;
+}
+
+uint8_t HalNetReceivePending()
+{
+  struct pollfd fds[MAXLISTENERS];
+  for (uint8_t i = 0; i < g_numlisteners; i++)
+  {
+    fds[i].fd = g_listeners[i].fd;
+    fds[i].events = POLLIN;
+  }
+
+  int ready = poll(fds, g_numlisteners, 0);
+  return ready > 0 ? ready : 0;
+}
+
+//maps the EEPROM file the first time it's used, a new file is erased to 0xFF like a new ATmega
+static uint8_t* Eeprom()
+{
+  if (g_eeprom)
+    return g_eeprom;
+
+  int fd = open(g_eepromfile, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1 || ftruncate(fd, HALEEPROMSIZE) == -1)
+  {
+    fprintf(stderr, "unable to open eeprom file %s: %s\n", g_eepromfile, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  void* map = mmap(NULL, HALEEPROMSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "unable to map eeprom file %s: %s\n", g_eepromfile, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  g_eeprom = (uint8_t*)map;
+  if (st.st_size < HALEEPROMSIZE)
+    memset(g_eeprom + st.st_size, 0xFF, HALEEPROMSIZE - st.st_size);
+
+  return g_eeprom;
+}
+
+void HalEepromRead(uint16_t address, uint8_t* data, uint16_t len)
+{
+  memcpy(data, Eeprom() + address, len);
+}
+
+void HalEepromWrite(uint16_t address, const uint8_t* data, uint16_t len)
+{
+  memcpy(Eeprom() + address, data, len);
+}
+
+LedType HalLedsInitialize(CRGB* leds, uint16_t numleds)
+{
+  size_t size = sizeof(SVirtualStrip) + numleds * sizeof(CRGB);
+  int fd = open(g_ledfile, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1 || ftruncate(fd, size) == -1)
+  {
+    fprintf(stderr, "unable to open led file %s: %s\n", g_ledfile, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "unable to map led file %s: %s\n", g_ledfile, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  g_strip = (SVirtualStrip*)map;
+  g_numleds = numleds;
+  memcpy(g_strip->magic, "LEDS", sizeof(g_strip->magic));
+  g_strip->numleds = numleds;
+  g_strip->ledtype = g_ledtype;
+  g_strip->frames = 0;
+
+  return g_ledtype;
+}
+
+void HalLedsShow(const CRGB* leds, uint16_t numleds)
+{
+  memcpy(g_strip->leds, leds, min(numleds, g_numleds) * sizeof(CRGB));
+  g_strip->frames++;
+}
+
+void HalLedsShowPalette(const uint8_t* leds, const CRGB* palette, uint16_t palettesize, uint16_t numleds)
+{
+  numleds = min(numleds, g_numleds);
+  for (uint16_t i = 0; i < numleds; i++)
+    g_strip->leds[i] = palette[leds[i] & (palettesize - 1)];
+  g_strip->frames++;
+}
@@ -0,0 +1,530 @@
+//the HAL for the nodes of loc_sim, see sim.cpp
+//the functions act on g_simnode, the node whose code is running, and advance its clock by what they
+//would take on the ATmega, the ENC28J60 and the leds, the code in between takes no virtual time
+
+#include <new>
+#include "sim.h"
+#include "../controller.h"
+
+//same layout as the EtherCard buffer, the udp payload starts after the ethernet, ip and udp headers
+#define UDP_DATA_P 42
+
+//bytes of a udp packet on the wire besides the payload: ethernet, ip and udp headers, and the crc
+#define FRAMEOVERHEAD (UDP_DATA_P + 4)
+//ethernet frames are padded to this
+#define MINFRAMESIZE 64
+//preamble, start of frame delimiter and the gap between frames
+#define WIREOVERHEAD 20
+
+//EtherCard leaves the last 1.5 KB of the ENC28J60 for transmitting, the rest is the receive buffer,
+//which stores a 6 byte status vector with every frame
+#define RXBUFFERSIZE 0x1A00
+#define RXSTATUSSIZE 6
+
+//costs in microseconds
+#define LOOPTIME        20    //one iteration of loop() that doesn't handle a packet
+#define PACKETTIME      150   //handling a packet, besides reading it from the ENC28J60
+#define SPIBYTETIME     1     //reading or writing a byte of the ENC28J60 buffer
+#define STRIPLEDTIME    30    //24 bits at 800 kHz for a WS2812B
+#define STRIPLATCHTIME  50
+#define EEPROMBYTETIME  3300
+#define NETBEGINTIME    2000  //reset and setup of the ENC28J60
+#define JUMPERTIME      10000 //HalLedsInitialize() waits for the jumper pin to rise
+#define DHCPTIME        20000 //a DHCP exchange
+
+//bytes of an IGMPv2 report with the ethernet and ip headers
+#define IGMPREPORTSIZE 46
+
+#define WATCHDOGTIMEOUT 8000000
+
+SSimNode* g_simnode;
+
+//the linker sets these around the section HALNOINIT puts variables in
+extern uint8_t __start_noinit[];
+extern uint8_t __stop_noinit[];
+
+//swaps the HALNOINIT variables of the running node for the ones of node, they're one per ATmega
+static void SimSelect(SSimNode* node)
+{
+  if (g_simnode == node)
+    return;
+
+  size_t size = __stop_noinit - __start_noinit;
+  if (g_simnode)
+    memcpy(g_simnode->noinit, __start_noinit, size);
+  memcpy(__start_noinit, node->noinit, size);
+  g_simnode = node;
+}
+
+static void Advance(simtime_t time)
+{
+  g_simnode->clock += time;
+}
+
+static uint32_t AddressToInt(const uint8_t* address)
+{
+  return ((uint32_t)address[0] << 24) | ((uint32_t)address[1] << 16) | ((uint32_t)address[2] << 8) | address[3];
+}
+
+simtime_t SimWireTime(uint16_t len)
+{
+  //10 Mbit is 0.8 microseconds per byte
+  return (max(len + FRAMEOVERHEAD, MINFRAMESIZE) + WIREOVERHEAD) * 4 / 5;
+}
+
+static uint16_t RxSize(uint16_t len)
+{
+  uint16_t size = RXSTATUSSIZE + max(len + FRAMEOVERHEAD, MINFRAMESIZE);
+  return (size + 1) & ~1;
+}
+
+SSimPacket* SimNewPacket(uint16_t len)
+{
+  SSimPacket* packet = (SSimPacket*)calloc(1, sizeof(SSimPacket) + len);
+  packet->refs = 1;
+  packet->len = len;
+  return packet;
+}
+
+void SimReleasePacket(SSimPacket* packet)
+{
+  if (--packet->refs == 0)
+    free(packet);
+}
+
+static void FlushReceive(SSimNode* node)
+{
+  for (; node->rxcount > 0; node->rxcount--)
+  {
+    SimReleasePacket(node->rx[node->rxhead]);
+    node->rxhead = (node->rxhead + 1) % SIMMAXPENDING;
+  }
+  node->rxused = 0;
+}
+
+static void SimUdp(uint16_t port, uint8_t ip[4], const char* data, uint16_t len)
+{
+  g_simnode->controller->HandlePacket(ip, port, (uint8_t*)data, len);
+}
+
+static uint16_t SimClassify(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len)
+{
+  return g_simnode->controller->ClassifyPacket(port, data, peeklen, len);
+}
+
+void SimInitNode(SSimNode* node, uint16_t index, const uint8_t* ip, const uint8_t* mask)
+{
+  memset(node, 0, sizeof(*node));
+  node->index = index;
+  memcpy(node->leaseip, ip, sizeof(node->leaseip));
+  memcpy(node->mask, mask, sizeof(node->mask));
+  memset(node->eeprom, 0xFF, sizeof(node->eeprom));
+  node->noinit = (uint8_t*)calloc(1, __stop_noinit - __start_noinit);
+  node->controller = (CController*)operator new(sizeof(CController));
+}
+
+void SimBootNode(SSimNode* node, simtime_t now)
+{
+  SimSelect(node);
+
+  //the HAL state of the ATmega is lost, the network keeps what's in flight
+  FlushReceive(node);
+  node->numlisteners = 0;
+  node->filter = false;
+  node->numgroups = 0;
+  node->clock = max(node->clock, now);
+  node->dhcprenewed = false;
+
+  //the same as setup() in loc_controller.ino,
+  //CController doesn't own anything, so it's constructed again without destroying it first
+  new (node->controller) CController();
+  HalWatchdogSetup();
+  node->controller->Initialize();
+  HalNetListen(ARTNETPORT, &SimUdp, &SimClassify);
+  HalNetListen(ARTNETPORT - 1, &SimUdp, &SimClassify);
+#if SACN
+  HalNetListen(SACNPORT, &SimUdp, &SimClassify);
+#endif
+}
+
+simtime_t SimRunNode(SSimNode* node, simtime_t now)
+{
+  SimSelect(node);
+  node->clock = max(node->clock, now);
+
+  if (node->clock - node->watchdogtime >= WATCHDOGTIMEOUT)
+  {
+    node->resets++;
+    SimBootNode(node, node->clock);
+    return node->clock;
+  }
+
+  node->controller->Poll();
+  node->controller->Process();
+  Advance(LOOPTIME);
+  return node->clock;
+}
+
+static bool IsBroadcast(SSimNode* node, const uint8_t* dstip)
+{
+  uint32_t address = AddressToInt(dstip);
+  uint32_t ip = AddressToInt(node->ip);
+  uint32_t mask = AddressToInt(node->mask);
+  return address == 0xFFFFFFFF || address == (ip | ~mask);
+}
+
+bool SimReceive(SSimNode* node, SSimPacket* packet)
+{
+  //the pattern match filter of the ENC28J60, the same as FilterAccepts() in hal_linux.cpp
+  if (node->filter && IsBroadcast(node, packet->dstip))
+  {
+    bool match = packet->dstport == node->filterport;
+    for (uint8_t i = 0; match && i < sizeof(node->filterpattern); i++)
+    {
+      if ((node->filtermask & (1 << i)) && (i >= packet->len || packet->data[i] != node->filterpattern[i]))
+        match = false;
+    }
+
+    if (!match)
+    {
+      node->filtered++;
+      return false;
+    }
+  }
+
+  uint16_t size = RxSize(packet->len);
+  if (node->rxcount == SIMMAXPENDING || node->rxused + size > RXBUFFERSIZE)
+  {
+    node->dropped++;
+    return false;
+  }
+
+  packet->refs++;
+  node->rx[(node->rxhead + node->rxcount) % SIMMAXPENDING] = packet;
+  node->rxcount++;
+  node->rxused += size;
+  node->received++;
+  return true;
+}
+
+uint32_t millis()
+{
+  return micros() / 1000;
+}
+
+uint32_t micros()
+{
+  return g_simnode ? g_simnode->clock : 0;
+}
+
+void delay(uint32_t ms)
+{
+  Advance((simtime_t)ms * 1000);
+}
+
+void HalWatchdogSetup()
+{
+  g_simnode->watchdogtime = g_simnode->clock;
+}
+
+void HalWatchdogReset()
+{
+  g_simnode->watchdogtime = g_simnode->clock;
+}
+
+bool HalNetBegin(const uint8_t* mac)
+{
+  memcpy(g_simnode->mac, mac, sizeof(g_simnode->mac));
+  FlushReceive(g_simnode);
+  Advance(NETBEGINTIME);
+  return true;
+}
+
+void HalNetEnableBroadcast()
+{
+  g_simnode->filter = false;
+}
+
+void HalNetFilterBroadcast(uint16_t port, const uint8_t* pattern, uint16_t mask)
+{
+  g_simnode->filter = true;
+  g_simnode->filterport = port;
+  memcpy(g_simnode->filterpattern, pattern, sizeof(g_simnode->filterpattern));
+  g_simnode->filtermask = mask;
+}
+
+bool SimJoined(SSimNode* node, const uint8_t* group)
+{
+  for (uint8_t i = 0; i < node->numgroups; i++)
+  {
+    if (memcmp(node->groups[i], group, 4) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+//the switch snoops the IGMP reports, so multicast only reaches the nodes that joined the group,
+//the hash filter of the ENC28J60 isn't modeled, and there are no queries
+void HalNetJoinMulticast(const uint8_t* group)
+{
+  SSimNode* node = g_simnode;
+  if (!SimJoined(node, group) && node->numgroups < SIMMAXGROUPS)
+    memcpy(node->groups[node->numgroups++], group, 4);
+
+  //writing the hash table and the IGMP report
+  Advance((8 + IGMPREPORTSIZE) * SPIBYTETIME);
+}
+
+void HalNetLeaveMulticast()
+{
+  g_simnode->numgroups = 0;
+}
+
+bool HalNetMulticastQueried()
+{
+  return false;
+}
+
+bool HalNetReceivedBroadcast()
+{
+  return g_simnode->broadcast;
+}
+
+void HalNetClearMulticastQueried()
+{
+}
+
+bool HalNetLinkUp()
+{
+  return true;
+}
+
+//the DHCP server always hands out leaseip, with the gateway and dns server on the first host address
+static void BindLease()
+{
+  uint32_t address = AddressToInt(g_simnode->leaseip);
+  uint32_t gateway = (address & AddressToInt(g_simnode->mask)) | 1;
+  memcpy(g_simnode->ip, g_simnode->leaseip, sizeof(g_simnode->ip));
+  for (uint8_t i = 0; i < 4; i++)
+    g_simnode->gw[i] = g_simnode->dns[i] = gateway >> (3 - i) * 8;
+}
+
+bool HalNetDhcpSetup()
+{
+  Advance(DHCPTIME);
+  BindLease();
+  return true;
+}
+
+void HalNetStaticSetup(const uint8_t* ip, const uint8_t* gw)
+{
+  memcpy(g_simnode->ip, ip, sizeof(g_simnode->ip));
+  memcpy(g_simnode->gw, gw, sizeof(g_simnode->gw));
+  memcpy(g_simnode->dns, gw, sizeof(g_simnode->dns));
+}
+
+void HalNetLeaseSetup(const uint8_t* ip, const uint8_t* mask, const uint8_t* gw)
+{
+  memcpy(g_simnode->ip, ip, sizeof(g_simnode->ip));
+  memcpy(g_simnode->mask, mask, sizeof(g_simnode->mask));
+  memcpy(g_simnode->gw, gw, sizeof(g_simnode->gw));
+  memcpy(g_simnode->dns, gw, sizeof(g_simnode->dns));
+  g_simnode->renewtime = g_simnode->clock + DHCPTIME;
+}
+
+bool HalNetDhcpRenewed()
+{
+  return g_simnode->dhcprenewed;
+}
+
+void HalNetClearDhcpRenewed()
+{
+  g_simnode->dhcprenewed = false;
+}
+
+uint8_t* HalNetIp()
+{
+  return g_simnode->ip;
+}
+
+uint8_t* HalNetMask()
+{
+  return g_simnode->mask;
+}
+
+uint8_t* HalNetGateway()
+{
+  return g_simnode->gw;
+}
+
+uint8_t* HalNetDns()
+{
+  return g_simnode->dns;
+}
+
+uint8_t* HalNetMac()
+{
+  return g_simnode->mac;
+}
+
+uint8_t* HalNetTransmitBuffer()
+{
+  return g_simnode->buffer + UDP_DATA_P;
+}
+
+void HalNetListen(uint16_t port, HalUdpCallback callback, HalUdpClassifier classifier)
+{
+  SSimNode* node = g_simnode;
+  if (node->numlisteners == sizeof(node->listeners) / sizeof(node->listeners[0]))
+    return;
+
+  node->listeners[node->numlisteners].port = port;
+  node->listeners[node->numlisteners].callback = callback;
+  node->listeners[node->numlisteners].classifier = classifier;
+  node->numlisteners++;
+}
+
+bool HalNetPoll()
+{
+  SSimNode* node = g_simnode;
+  if (node->renewtime && node->clock >= node->renewtime)
+  {
+    BindLease();
+    node->renewtime = 0;
+    node->dhcprenewed = true;
+  }
+
+  if (node->rxcount == 0)
+    return false;
+
+  SSimPacket* packet = node->rx[node->rxhead];
+  node->rxhead = (node->rxhead + 1) % SIMMAXPENDING;
+  node->rxcount--;
+  node->rxused -= RxSize(packet->len);
+  Advance(PACKETTIME);
+
+  SSimListener* listener = NULL;
+  for (uint8_t i = 0; i < node->numlisteners; i++)
+  {
+    if (node->listeners[i].port == packet->dstport)
+      listener = node->listeners + i;
+  }
+
+  //like the ENC28J60 HAL, only the bytes the classifier asks for are read,
+  //packets that don't fit in the buffer are dropped
+  uint16_t needed = packet->len;
+  if (listener && listener->classifier)
+    needed = listener->classifier(packet->dstport, packet->data, min(packet->len, HALPEEKSIZE), packet->len);
+  needed = min(needed, packet->len);
+  Advance((UDP_DATA_P + max(needed, HALPEEKSIZE)) * SPIBYTETIME);
+
+  if (!listener || needed == 0 || packet->len > sizeof(node->buffer) - UDP_DATA_P - 1)
+  {
+    //like the ENC28J60 HAL, a dropped packet still counts as received
+    node->rejected++;
+    SimReleasePacket(packet);
+    return true;
+  }
+
+  //led data is timed from when it was sent until the leds show it
+  uint16_t opcode = packet->len >= 10 ? packet->data[8] | (packet->data[9] << 8) : 0;
+  if (packet->dstport == SACNPORT || opcode == OpOutput || opcode == OpNzs || opcode == OpSync)
+  {
+    node->datasent = packet->sendtime;
+    node->datapending = true;
+  }
+
+  uint8_t* data = node->buffer + UDP_DATA_P;
+  uint16_t len = packet->len;
+  uint8_t  ip[4];
+  memcpy(data, packet->data, needed);
+  data[len] = 0;
+  memcpy(ip, packet->srcip, sizeof(ip));
+  node->broadcast = IsBroadcast(node, packet->dstip);
+  SimReleasePacket(packet);
+
+  listener->callback(listener->port, ip, (const char*)data, len);
+  return true;
+}
+
+void HalNetTransmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport)
+{
+  SSimNode* node = g_simnode;
+  Advance(size * SPIBYTETIME);
+
+  //the packet is sent when the previous one is done
+  simtime_t start = max(node->clock, node->txfree);
+  node->txfree = start + SimWireTime(size);
+
+  SSimPacket* packet = SimNewPacket(size);
+  packet->sendtime = node->txfree;
+  memcpy(packet->srcip, node->ip, sizeof(packet->srcip));
+  packet->srcport = sourceport;
+  memcpy(packet->dstip, destip, sizeof(packet->dstip));
+  packet->dstport = destport;
+  memcpy(packet->data, data, size);
+  node->transmitted++;
+
+  SimTransmit(node, packet);
+  SimReleasePacket(packet);
+}
+
+bool HalNetTransmitBusy()
+{
+  return g_simnode->txfree > g_simnode->clock;
+}
+
+uint8_t HalNetReceivePending()
+{
+  return g_simnode->rxcount;
+}
+
+void HalEepromRead(uint16_t address, uint8_t* data, uint16_t len)
+{
+  memcpy(data, g_simnode->eeprom + address, len);
+}
+
+void HalEepromWrite(uint16_t address, const uint8_t* data, uint16_t len)
+{
+  for (uint16_t i = 0; i < len; i++)
+  {
+    if (g_simnode->eeprom[address + i] != data[i])
+    {
+      g_simnode->eeprom[address + i] = data[i];
+      Advance(EEPROMBYTETIME);
+    }
+  }
+}
+
+LedType HalLedsInitialize(CRGB* leds, uint16_t numleds)
+{
+  Advance(JUMPERTIME);
+  return LedStrip;
+}
+
+static void ShowLeds(uint16_t numleds)
+{
+  SSimNode* node = g_simnode;
+  Advance(numleds * STRIPLEDTIME + STRIPLATCHTIME);
+  node->framesshown++;
+
+  if (node->datapending)
+  {
+    simtime_t latency = node->clock - node->datasent;
+    node->latencysum += latency;
+    node->latencycount++;
+    node->latencymax = max(node->latencymax, latency);
+    node->datapending = false;
+  }
+}
+
+void HalLedsShow(const CRGB* leds, uint16_t numleds)
+{
+  ShowLeds(numleds);
+}
+
+void HalLedsShowPalette(const uint8_t* leds, const CRGB* palette, uint16_t palettesize, uint16_t numleds)
+{
+  ShowLeds(numleds);
+}
@@ -0,0 +1,54 @@
+#ifndef HOST_H
+#define HOST_H
+
+//the part of the Arduino and avr-libc api used by the firmware, for building it as a Linux process
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef uint8_t  byte;
+typedef uint16_t word;
+
+#define PROGMEM
+#define PSTR(str) (str)
+#define printf_P printf
+#define snprintf_P snprintf
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strcpy_P strcpy
+#define strcasecmp_P strcasecmp
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+
+struct CRGB
+{
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+//layout of the memory mapped file the leds are rendered into,
+//frames is incremented after every show, so a viewer can tell when the leds changed
+struct SVirtualStrip
+{
+  char     magic[4]; //"LEDS"
+  uint32_t numleds;
+  uint32_t ledtype;
+  uint32_t frames;
+  CRGB     leds[];
+};
+
+//parses the command line of the host build, see host/main.cpp
+void HalHostConfigure(int argc, char* argv[]);
+
+#endif //HOST_H
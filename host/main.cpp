@@ -0,0 +1,20 @@
+//Linux build of the led controller
+//runs the same setup() and loop() as the firmware, the art-net ports are real UDP sockets
+//and the leds are rendered into a memory mapped file, see SVirtualStrip in host.h,
+//the EEPROM is another memory mapped file
+//
+//usage: loc_host [-a ip/prefix] [-l ledfile] [-e eepromfile] [-p]
+
+#include "host.h"
+
+void setup();
+void loop();
+
+int main(int argc, char* argv[])
+{
+  HalHostConfigure(argc, argv);
+
+  setup();
+  for (;;)
+    loop();
+}
@@ -0,0 +1,475 @@
+//sends raw rgb frames read from stdin to a node as run length encoded ArtNzs,
+//see SNzsHeader and NzsRun in artnet.h for the format
+//leds that didn't change since the previous frame are skipped, except in key frames,
+//which resend every led so a lost packet doesn't leave leds behind for long
+//for nodes built with PALETTE, -i reads a palette index per led, and -p sends the palette with every key frame
+//-o writes the frames into a cue table instead, one cue per changed frame at timecode rate -f, starting at -t,
+//and -c uploads a cue table to the EEPROM of the node, see cues.h
+//
+//usage: loc_nzs [-a ip] [-u portaddress] [-n leds] [-f fps] [-k interval] [-i] [-p palettefile] < frames
+//       loc_nzs [-n leds] [-f fps] [-t hh:mm:ss:ff] [-i] -o cuefile < frames
+//       loc_nzs [-a ip] [-u portaddress] -c cuefile
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "../artnet.h"
+#include "../cues.h"
+
+#define HEADERSIZE (sizeof(SArtNzs) - sizeof(((SArtNzs*)0)->Data))
+#define MAXDATA    (512 - sizeof(SNzsHeader))
+
+//bytes of the cue table sent in one packet, the node takes 3.3 ms to write each byte
+#define CUEBLOCKDELAY 150 //more than the node needs to write CUEBLOCKSIZE bytes to the EEPROM
+
+static const char* g_address = "255.255.255.255";
+static uint16_t    g_portaddress;
+static uint16_t    g_numleds = 170;
+static uint16_t    g_fps = 40;
+static uint16_t    g_keyinterval = 40;
+static uint8_t     g_ledsize = 3;       //bytes per led in the frames and the runs
+static uint8_t     g_palette[256 * 3];
+static uint16_t    g_palettesize;       //bytes in g_palette
+static uint32_t    g_starttime;         //timecode of the first cue, in frames
+
+static bool        g_cuemode;           //encoding the frames into g_cuetable instead of sending them
+static uint8_t     g_cuetable[CUETABLESIZE];
+static uint16_t    g_cuetablesize;
+static uint32_t    g_cueframe;          //timecode of the frame being encoded, in frames
+
+static int         g_fd;
+static sockaddr_in g_dest;
+static uint8_t     g_packet[HEADERSIZE + sizeof(SNzsHeader) + CUETABLESIZE];
+static uint16_t    g_packetsize; //bytes of run data in g_packet
+static uint16_t    g_maxdata = MAXDATA;
+static uint8_t     g_sequence;
+static uint64_t    g_bytessent;
+static uint32_t    g_packetssent;
+
+static void Usage(const char* name)
+{
+  fprintf(stderr,
+          "usage: %s [-a ip] [-u portaddress] [-n leds] [-f fps] [-k interval] [-i] [-p palettefile] < frames\n"
+          "       %s [-n leds] [-f fps] [-t hh:mm:ss:ff] [-i] -o cuefile < frames\n"
+          "       %s [-a ip] [-u portaddress] -c cuefile\n"
+          "  -a  address of the node, default %s\n"
+          "  -u  port address of the first universe, default %u\n"
+          "  -n  number of leds in a frame, stdin is read in frames of 3 bytes per led, default %u\n"
+          "  -i  frames are a palette index per led\n"
+          "  -p  file with up to 256 rgb palette colors, sent with every key frame, the node keeps PALETTESIZE of them\n"
+          "  -o  write the frames into a cue table, one cue for every frame that changed\n"
+          "  -t  timecode of the first frame in the cue table, default 00:00:00:00\n"
+          "  -c  upload a cue table to the node\n"
+          "  -f  frames per second, 0 sends them as fast as they are read, the timecode rate with -o, default %u\n"
+          "  -k  send every led once every this many frames, 0 only does it for the first frame, default %u\n",
+          name, name, name, g_address, g_portaddress, g_numleds, g_fps, g_keyinterval);
+}
+
+static bool SameLed(const uint8_t* a, const uint8_t* b)
+{
+  return memcmp(a, b, g_ledsize) == 0;
+}
+
+static void StartPacket(uint16_t start)
+{
+  SArtNzs* nzsmsg = (SArtNzs*)g_packet;
+  SNzsHeader* header = (SNzsHeader*)nzsmsg->Data;
+
+  memcpy(nzsmsg->ID, "Art-Net", 8);
+  nzsmsg->OpCode = OpNzs;
+  nzsmsg->ProtVerHi = 0;
+  nzsmsg->ProtVerLow = 14;
+  nzsmsg->StartCode = NZS_STARTCODE;
+  nzsmsg->SubUni = g_portaddress & 0xFF;
+  nzsmsg->Net = g_portaddress >> 8;
+  header->ManufacturerHi = NZS_MANUFACTURER >> 8;
+  header->ManufacturerLo = NZS_MANUFACTURER & 0xFF;
+  header->StartHi = start >> 8;
+  header->StartLo = start & 0xFF;
+
+  g_packetsize = 0;
+}
+
+//appends the runs in g_packet to the cue table as a cue at g_cueframe
+static void AddCue(bool lastpacket)
+{
+  SNzsHeader* header = (SNzsHeader*)((SArtNzs*)g_packet)->Data;
+  SCueTable*  table = (SCueTable*)g_cuetable;
+
+  //a frame that doesn't fit in one packet means the runs filled the rest of the table
+  if (!lastpacket || g_cuetablesize + sizeof(SCue) + g_packetsize > sizeof(g_cuetable) || table->NumCues == 255)
+  {
+    fprintf(stderr, "the cue table is full at frame %u\n", g_cueframe - g_starttime);
+    exit(EXIT_FAILURE);
+  }
+
+  SCue* cue = (SCue*)(g_cuetable + g_cuetablesize);
+  cue->Hours = g_cueframe / g_fps / 3600;
+  cue->Minutes = g_cueframe / g_fps / 60 % 60;
+  cue->Seconds = g_cueframe / g_fps % 60;
+  cue->Frames = g_cueframe % g_fps;
+  cue->StartHi = header->StartHi;
+  cue->StartLo = header->StartLo;
+  cue->LengthHi = g_packetsize >> 8;
+  cue->LengthLo = g_packetsize & 0xFF;
+  memcpy(cue + 1, header + 1, g_packetsize);
+
+  g_cuetablesize += sizeof(SCue) + g_packetsize;
+  table->NumCues++;
+}
+
+static void SendPacket(bool lastpacket, uint8_t flags = 0)
+{
+  SArtNzs* nzsmsg = (SArtNzs*)g_packet;
+  SNzsHeader* header = (SNzsHeader*)nzsmsg->Data;
+
+  if (g_cuemode)
+  {
+    AddCue(lastpacket);
+    return;
+  }
+
+  //0 means no sequence numbers are used
+  if (++g_sequence == 0)
+    g_sequence = 1;
+
+  uint16_t length = sizeof(SNzsHeader) + g_packetsize;
+  nzsmsg->Sequence = g_sequence;
+  nzsmsg->LengthHi = length >> 8;
+  nzsmsg->Length = length & 0xFF;
+  header->Flags = flags | (lastpacket ? NzsLastPacket : 0);
+
+  if (sendto(g_fd, g_packet, HEADERSIZE + length, 0, (sockaddr*)&g_dest, sizeof(g_dest)) == -1)
+    perror("sendto");
+
+  g_bytessent += HEADERSIZE + length;
+  g_packetssent++;
+}
+
+//appends a run to the packet, literal runs are shortened to what fits,
+//returns the number of leds in the run, 0 if nothing fits
+static uint16_t AddRun(uint8_t type, const uint8_t* leds, uint16_t count)
+{
+  uint8_t* data = ((SArtNzs*)g_packet)->Data + sizeof(SNzsHeader) + g_packetsize;
+  uint16_t space = g_maxdata - g_packetsize;
+
+  if (type == NzsLiteral)
+    count = space > g_ledsize ? min(count, (space - 1) / g_ledsize) : 0;
+  else if (space < (type == NzsRepeat ? 1 + g_ledsize : 1))
+    count = 0;
+
+  if (count == 0)
+    return 0;
+
+  *data++ = type | (count - 1);
+  g_packetsize++;
+
+  if (type == NzsLiteral)
+  {
+    memcpy(data, leds, count * g_ledsize);
+    g_packetsize += count * g_ledsize;
+  }
+  else if (type == NzsRepeat)
+  {
+    memcpy(data, leds, g_ledsize);
+    g_packetsize += g_ledsize;
+  }
+
+  return count;
+}
+
+//true if led n of the frame is the same as in the previous one, prev is NULL when every led is sent
+static bool Unchanged(const uint8_t* leds, const uint8_t* prev, uint16_t n)
+{
+  return prev && SameLed(leds + n * g_ledsize, prev + n * g_ledsize);
+}
+
+//true if led n of the frame is the same as the led after it
+static bool SameAsNext(const uint8_t* leds, uint16_t n)
+{
+  return n + 1 < g_numleds && SameLed(leds + n * g_ledsize, leds + (n + 1) * g_ledsize);
+}
+
+//encodes a frame into as many packets as needed and sends them,
+//prev is the frame the node shows now, or NULL to send every led
+static void SendFrame(const uint8_t* leds, const uint8_t* prev)
+{
+  uint16_t led = 0;
+
+  //leds that didn't change at the start of the frame are left out by starting the packet after them
+  while (led < g_numleds && Unchanged(leds, prev, led))
+    led++;
+  //if nothing changed, an empty packet at the first led still ends the frame
+  StartPacket(led < g_numleds ? led : 0);
+
+  while (led < g_numleds)
+  {
+    uint8_t  type;
+    uint16_t count = 1;
+    uint16_t maxcount = min(NZS_MAXRUN, g_numleds - led);
+
+    if (Unchanged(leds, prev, led))
+    {
+      type = NzsSkip;
+      while (count < maxcount && Unchanged(leds, prev, led + count))
+        count++;
+
+      //nothing changed after this, the node keeps the rest of the frame
+      if (led + count == g_numleds)
+        break;
+    }
+    else if (count < maxcount && SameAsNext(leds, led))
+    {
+      type = NzsRepeat;
+      while (count < maxcount && SameAsNext(leds, led + count - 1))
+        count++;
+    }
+    else
+    {
+      //stop before leds that are cheaper to send as a skip or repeat run
+      type = NzsLiteral;
+      while (count < maxcount && !Unchanged(leds, prev, led + count) && !SameAsNext(leds, led + count))
+        count++;
+    }
+
+    uint16_t added = AddRun(type, leds + led * g_ledsize, count);
+    if (added == 0)
+    {
+      //the packet is full, continue in the next one, skipping unchanged leds
+      SendPacket(false);
+      while (led < g_numleds && Unchanged(leds, prev, led))
+        led++;
+      StartPacket(led < g_numleds ? led : 0);
+      continue;
+    }
+
+    led += added;
+  }
+
+  SendPacket(true);
+}
+
+//sends the palette in as many packets as needed, the frame sent after it shows the new colors
+static void SendPalette()
+{
+  uint16_t maxcolors = MAXDATA / 3;
+  for (uint16_t color = 0; color < g_palettesize / 3; color += maxcolors)
+  {
+    StartPacket(color);
+    g_packetsize = min(g_palettesize - color * 3, maxcolors * 3);
+    memcpy(((SArtNzs*)g_packet)->Data + sizeof(SNzsHeader), g_palette + color * 3, g_packetsize);
+    SendPacket(false, NzsPalette);
+  }
+}
+
+static void SendCueBlock(uint16_t offset, uint16_t size)
+{
+  StartPacket(offset);
+  g_packetsize = size;
+  memcpy(((SArtNzs*)g_packet)->Data + sizeof(SNzsHeader), g_cuetable + offset, size);
+  SendPacket(false, NzsCues);
+
+  struct timespec delay = { 0, CUEBLOCKDELAY * 1000000L };
+  nanosleep(&delay, NULL);
+}
+
+//sends the cue table in small blocks, so the node has time to write each to the EEPROM,
+//the magic goes last, so the node doesn't play a table that's only partly uploaded
+static void UploadCues(const char* filename)
+{
+  FILE* file = fopen(filename, "rb");
+  if (!file)
+  {
+    perror(filename);
+    exit(EXIT_FAILURE);
+  }
+  uint16_t size = fread(g_cuetable, 1, sizeof(g_cuetable), file);
+  fclose(file);
+
+  if (size < sizeof(SCueTable) || g_cuetable[0] != CUEMAGIC >> 8 || g_cuetable[1] != (CUEMAGIC & 0xFF))
+  {
+    fprintf(stderr, "%s is not a cue table\n", filename);
+    exit(EXIT_FAILURE);
+  }
+
+  uint8_t magic[2] = { g_cuetable[0], g_cuetable[1] };
+  g_cuetable[0] = g_cuetable[1] = 0xFF;
+
+  for (uint16_t offset = 0; offset < size; offset += CUEBLOCKSIZE)
+    SendCueBlock(offset, min(size - offset, CUEBLOCKSIZE));
+
+  memcpy(g_cuetable, magic, sizeof(magic));
+  SendCueBlock(0, sizeof(magic));
+
+  fprintf(stderr, "uploaded %u bytes of cues in %u packets\n", size, g_packetssent);
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  const char* palettefile = NULL;
+  const char* cuefile = NULL;
+  const char* uploadfile = NULL;
+  const char* starttime = "00:00:00:00";
+  while ((c = getopt(argc, argv, "a:u:n:f:k:ip:o:t:c:h")) != -1)
+  {
+    if (c == 'a')
+      g_address = optarg;
+    else if (c == 'u')
+      g_portaddress = strtoul(optarg, NULL, 0);
+    else if (c == 'n')
+      g_numleds = strtoul(optarg, NULL, 0);
+    else if (c == 'f')
+      g_fps = strtoul(optarg, NULL, 0);
+    else if (c == 'k')
+      g_keyinterval = strtoul(optarg, NULL, 0);
+    else if (c == 'i')
+      g_ledsize = 1;
+    else if (c == 'p')
+      palettefile = optarg;
+    else if (c == 'o')
+      cuefile = optarg;
+    else if (c == 't')
+      starttime = optarg;
+    else if (c == 'c')
+      uploadfile = optarg;
+    else
+    {
+      Usage(argv[0]);
+      return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (g_numleds == 0)
+  {
+    fprintf(stderr, "number of leds must be at least 1\n");
+    return EXIT_FAILURE;
+  }
+
+  if (palettefile)
+  {
+    FILE* file = fopen(palettefile, "rb");
+    if (!file)
+    {
+      perror(palettefile);
+      return EXIT_FAILURE;
+    }
+    g_palettesize = fread(g_palette, 1, sizeof(g_palette), file) / 3 * 3;
+    fclose(file);
+  }
+
+  if (cuefile)
+  {
+    unsigned int hours, minutes, seconds, frames;
+    if (g_fps == 0 || g_fps > 30)
+    {
+      fprintf(stderr, "the timecode rate must be from 1 to 30 fps\n");
+      return EXIT_FAILURE;
+    }
+    if (sscanf(starttime, "%u:%u:%u:%u", &hours, &minutes, &seconds, &frames) != 4 ||
+        minutes > 59 || seconds > 59 || frames >= g_fps)
+    {
+      fprintf(stderr, "invalid timecode %s\n", starttime);
+      return EXIT_FAILURE;
+    }
+
+    //the runs of a cue go into a single packet the size of the table,
+    //only the first cue sets every led, the ones after it only hold the leds that changed
+    g_cuemode = true;
+    g_maxdata = sizeof(g_cuetable);
+    g_keyinterval = 0;
+    g_palettesize = 0;
+    g_starttime = ((hours * 60 + minutes) * 60 + seconds) * g_fps + frames;
+    g_cueframe = g_starttime;
+    g_cuetablesize = sizeof(SCueTable);
+    ((SCueTable*)g_cuetable)->MagicHi = CUEMAGIC >> 8;
+    ((SCueTable*)g_cuetable)->MagicLo = CUEMAGIC & 0xFF;
+  }
+
+  g_dest.sin_family = AF_INET;
+  g_dest.sin_port = htons(ARTNETPORT);
+  if (inet_pton(AF_INET, g_address, &g_dest.sin_addr) != 1)
+  {
+    fprintf(stderr, "invalid address %s\n", g_address);
+    return EXIT_FAILURE;
+  }
+
+  g_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1;
+  if (g_fd == -1 || setsockopt(g_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) == -1)
+  {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+
+  if (uploadfile)
+  {
+    UploadCues(uploadfile);
+    close(g_fd);
+    return EXIT_SUCCESS;
+  }
+
+  uint8_t* frame = new uint8_t[g_numleds * g_ledsize];
+  uint8_t* prev = new uint8_t[g_numleds * g_ledsize];
+  uint32_t frames = 0;
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (fread(frame, g_ledsize, g_numleds, stdin) == g_numleds)
+  {
+    bool keyframe = frames == 0 || (g_keyinterval > 0 && frames % g_keyinterval == 0);
+    if (keyframe && g_palettesize > 0)
+      SendPalette();
+
+    if (!g_cuemode || keyframe || memcmp(frame, prev, g_ledsize * g_numleds) != 0)
+      SendFrame(frame, keyframe ? NULL : prev);
+    memcpy(prev, frame, g_ledsize * g_numleds);
+    frames++;
+
+    if (g_cuemode)
+    {
+      g_cueframe++;
+    }
+    else if (g_fps > 0)
+    {
+      next.tv_nsec += 1000000000L / g_fps;
+      if (next.tv_nsec >= 1000000000L)
+      {
+        next.tv_sec++;
+        next.tv_nsec -= 1000000000L;
+      }
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0) {}
+    }
+  }
+
+  if (g_cuemode)
+  {
+    FILE* file = fopen(cuefile, "wb");
+    if (!file || fwrite(g_cuetable, 1, g_cuetablesize, file) != g_cuetablesize)
+    {
+      perror(cuefile);
+      return EXIT_FAILURE;
+    }
+    fclose(file);
+    fprintf(stderr, "wrote %u cues from %u frames, %u of %u bytes\n",
+            ((SCueTable*)g_cuetable)->NumCues, frames, g_cuetablesize, (unsigned int)sizeof(g_cuetable));
+  }
+  else if (frames > 0)
+  {
+    //an ArtDmx universe carries 510 channels
+    uint32_t artdmxbytes = frames * ((g_numleds * g_ledsize + 509) / 510) * (HEADERSIZE + 510);
+    fprintf(stderr, "sent %u frames in %u packets, %llu bytes, %llu bytes per frame, ArtDmx would take %u\n",
+            frames, g_packetssent, (unsigned long long)g_bytessent,
+            (unsigned long long)(g_bytessent / frames), artdmxbytes / frames);
+  }
+
+  delete[] frame;
+  delete[] prev;
+  close(g_fd);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,724 @@
+//discrete event simulation of a network of nodes, for benchmarking traffic scenarios without hardware
+//every node runs its own CController on hal_sim.cpp, in virtual time, the costs of the ATmega,
+//the ENC28J60 receive buffer, the 10 Mbit links and showing the leds are modeled there
+//
+//the nodes get consecutive host addresses in 10.0.0.0/8 and boot at the start,
+//the traffic starts after -w, and is made up of:
+//  led data for every node at -f frames per second, unicast, or broadcast with -b, followed by ArtSync with -y
+//  ArtPoll from -c controllers every -p milliseconds
+//  ArtDmx for -x universes that belong to none of the nodes
+//  with -e the led data and the universes for no node are sent as sACN to the multicast group of each universe instead,
+//  the switch snoops IGMP, so a node only gets the groups it joined
+//  the packets of a pcap capture with -i, broadcasts go to every node, unicasts to the node with the same host address
+//-d sends every packet to port 6453 as well, -r renews the DHCP lease of every node during the run
+//
+//usage: loc_sim [-n nodes] [-t seconds] [-w ms] [-f fps] [-b] [-y] [-e] [-p ms] [-c controllers] [-x universes]
+//               [-d] [-r seconds:spread] [-i pcapfile] [-v]
+
+#include <getopt.h>
+#include <time.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "sim.h"
+#include "../controller.h"
+
+//the switch drops packets for a node when its link is backed up by more than this
+#define SWITCHQUEUETIME 100000
+//microseconds per byte on the 1 Gbit link of the controllers
+#define UPLINKBYTETIME 0.008
+//bucket size of the poll reply timeline
+#define TIMELINEBUCKET 50000
+
+enum EventType
+{
+  EventRun,     //a node runs loop()
+  EventArrive,  //a packet has come in over the link of a node
+  EventSource,  //a traffic source sends its next packets
+};
+
+struct SEvent
+{
+  simtime_t   time;
+  uint32_t    order; //events at the same time are handled in the order they were added
+  EventType   type;
+  uint32_t    index; //of the node or source
+  SSimPacket* packet;
+};
+
+struct SEventLater
+{
+  bool operator()(const SEvent& a, const SEvent& b) const
+  {
+    return a.time > b.time || (a.time == b.time && a.order > b.order);
+  }
+};
+
+enum SourceType
+{
+  SourceFrames,
+  SourceForeign,
+  SourcePoll,
+  SourcePcap,
+};
+
+struct SSource
+{
+  SourceType type;
+  simtime_t  interval;
+  uint32_t   count;   //times it has sent
+  uint8_t    ip[4];
+};
+
+struct SPollReply
+{
+  simtime_t time;
+  uint32_t  node;
+};
+
+static uint32_t    g_numnodes = 100;
+static double      g_seconds = 10;
+static uint32_t    g_warmup = 1000;
+static uint32_t    g_fps = 40;
+static bool        g_broadcastframes;
+static bool        g_sync;
+static bool        g_sacn;
+static uint32_t    g_pollinterval = 2500;
+static uint32_t    g_numcontrollers = 1;
+static uint32_t    g_foreign;
+static bool        g_duplicate;
+static double      g_renewtime = -1;
+static double      g_renewspread;
+static const char* g_pcapfile;
+static bool        g_verbose;
+
+static SSimNode*   g_nodes;
+static std::priority_queue<SEvent, std::vector<SEvent>, SEventLater> g_events;
+static uint32_t    g_eventorder;
+static uint64_t    g_eventcount;
+static std::vector<SSource>     g_sources;
+static std::vector<SSimPacket*> g_pcap;
+static std::vector<simtime_t>   g_polls;
+static std::vector<SPollReply>  g_pollreplies;
+static double      g_uplinkfree;  //when the controllers' link to the switch is free
+static uint64_t    g_packetssent; //by the sources
+
+static const uint8_t g_nodemask[4] = { 255, 0, 0, 0 };
+
+static void Usage(const char* name)
+{
+  fprintf(stderr,
+          "usage: %s [-n nodes] [-t seconds] [-w ms] [-f fps] [-b] [-y] [-e] [-p ms] [-c controllers] [-x universes]\n"
+          "       %*s [-d] [-r seconds:spread] [-i pcapfile] [-v]\n"
+          "  -n  number of nodes, default %u\n"
+          "  -t  seconds of virtual time to simulate, default %g\n"
+          "  -w  milliseconds after the nodes boot before traffic is sent, default %u\n"
+          "  -f  frames per second of led data sent to every node, 0 sends none, default %u\n"
+          "  -b  broadcast the led data instead of sending it to every node\n"
+          "  -y  send ArtSync after every frame\n"
+          "  -e  send the led data as sACN multicast instead of ArtDmx\n"
+          "  -p  milliseconds between the ArtPolls of each controller, 0 sends none, default %u\n"
+          "  -c  number of controllers sending ArtPoll, spread over the interval, default %u\n"
+          "  -x  number of universes for no node, broadcast at the frame rate, default 0\n"
+          "  -d  send every packet to port %u as well as %u\n"
+          "  -r  renew the DHCP lease of the nodes after this many seconds, spread over this many seconds\n"
+          "  -i  replay the Art-Net packets of a pcap capture\n"
+          "  -v  print the statistics of every node\n",
+          name, (int)strlen(name), "", g_numnodes, g_seconds, g_warmup, g_fps, g_pollinterval, g_numcontrollers,
+          ARTNETPORT - 1, ARTNETPORT);
+}
+
+static uint32_t AddressToInt(const uint8_t* address)
+{
+  return ((uint32_t)address[0] << 24) | ((uint32_t)address[1] << 16) | ((uint32_t)address[2] << 8) | address[3];
+}
+
+static void IntToAddress(uint8_t* address, uint32_t value)
+{
+  for (uint8_t i = 0; i < 4; i++)
+    address[i] = value >> (3 - i) * 8;
+}
+
+static void AddEvent(simtime_t time, EventType type, uint32_t index, SSimPacket* packet = NULL)
+{
+  SEvent event = { time, g_eventorder++, type, index, packet };
+  g_events.push(event);
+}
+
+//makes the node run loop() at time, unless it runs before then already
+static void WakeNode(SSimNode* node, simtime_t time)
+{
+  time = max(time, node->clock);
+  if (time < node->nextrun)
+  {
+    node->nextrun = time;
+    AddEvent(time, EventRun, node->index);
+  }
+}
+
+//sends the packet over the link from the switch to the node
+static void Deliver(SSimNode* node, SSimPacket* packet)
+{
+  simtime_t start = max(packet->sendtime, node->linkfree);
+  if (start - packet->sendtime > SWITCHQUEUETIME)
+  {
+    node->lost++;
+    return;
+  }
+
+  node->linkfree = start + SimWireTime(packet->len);
+  packet->refs++;
+  AddEvent(node->linkfree, EventArrive, node->index, packet);
+}
+
+//the node that has the host address of ip in the node subnet
+static SSimNode* NodeForAddress(const uint8_t* ip)
+{
+  uint32_t host = AddressToInt(ip) & ~AddressToInt(g_nodemask);
+  if (host == 0 || host > g_numnodes)
+    return NULL;
+
+  return g_nodes + host - 1;
+}
+
+static bool IsBroadcast(const uint8_t* ip)
+{
+  return (AddressToInt(ip) | AddressToInt(g_nodemask)) == 0xFFFFFFFF;
+}
+
+static bool IsMulticast(const uint8_t* ip)
+{
+  return ip[0] >= 224 && ip[0] <= 239;
+}
+
+//the switch forwards the packet to every node it's for, sender is NULL for the controllers
+static void Route(SSimPacket* packet, SSimNode* sender)
+{
+  if (IsBroadcast(packet->dstip) || IsMulticast(packet->dstip))
+  {
+    bool multicast = IsMulticast(packet->dstip);
+    for (uint32_t i = 0; i < g_numnodes; i++)
+    {
+      if (g_nodes + i != sender && (!multicast || SimJoined(g_nodes + i, packet->dstip)))
+        Deliver(g_nodes + i, packet);
+    }
+  }
+  else
+  {
+    SSimNode* node = NodeForAddress(packet->dstip);
+    if (node && node != sender)
+      Deliver(node, packet);
+  }
+}
+
+void SimTransmit(SSimNode* node, SSimPacket* packet)
+{
+  //the controllers receive every ArtPollReply, they're broadcast
+  uint16_t opcode = packet->len >= 10 ? packet->data[8] | (packet->data[9] << 8) : 0;
+  if (opcode == OpPollReply)
+  {
+    SPollReply reply = { packet->sendtime, node->index };
+    g_pollreplies.push_back(reply);
+  }
+
+  Route(packet, node);
+}
+
+//sends a packet from a controller, now is when it's ready, it goes out when the uplink is free
+static void Send(SSimPacket* packet, simtime_t now)
+{
+  g_uplinkfree = max(g_uplinkfree, (double)now) + (packet->len + 66) * UPLINKBYTETIME;
+  packet->sendtime = g_uplinkfree;
+  packet->srcport = ARTNETPORT;
+  g_packetssent++;
+  Route(packet, NULL);
+
+  if (g_duplicate && packet->dstport == ARTNETPORT)
+  {
+    SSimPacket* copy = SimNewPacket(packet->len);
+    memcpy(copy, packet, sizeof(SSimPacket) + packet->len);
+    copy->refs = 1;
+    copy->dstport = ARTNETPORT - 1;
+    Send(copy, now);
+  }
+
+  SimReleasePacket(packet);
+}
+
+static SSimPacket* NewArtNet(uint16_t opcode, uint16_t len, const uint8_t* srcip, const uint8_t* dstip)
+{
+  SSimPacket* packet = SimNewPacket(len);
+  memcpy(packet->data, "Art-Net", 8);
+  packet->data[8] = opcode & 0xFF;
+  packet->data[9] = opcode >> 8;
+  packet->data[11] = 14;
+  memcpy(packet->srcip, srcip, sizeof(packet->srcip));
+  memcpy(packet->dstip, dstip, sizeof(packet->dstip));
+  packet->dstport = ARTNETPORT;
+  return packet;
+}
+
+static void SendDmx(const uint8_t* srcip, const uint8_t* dstip, uint16_t portaddress, uint8_t sequence, uint8_t value, simtime_t now)
+{
+  uint16_t channels = LEDS_PER_UNIVERSE * sizeof(CLed);
+  SSimPacket* packet = NewArtNet(OpOutput, sizeof(SArtDmx) - sizeof(((SArtDmx*)0)->Data) + channels, srcip, dstip);
+  SArtDmx* dmxmsg = (SArtDmx*)packet->data;
+  dmxmsg->Sequence = sequence;
+  dmxmsg->SubUni = portaddress & 0xFF;
+  dmxmsg->Net = portaddress >> 8;
+  dmxmsg->LengthHi = channels >> 8;
+  dmxmsg->Length = channels & 0xFF;
+  memset(dmxmsg->Data, value, channels);
+  Send(packet, now);
+}
+
+#if SACN
+//sends the led data of portaddress to the multicast group of sACN universe portaddress + 1
+static void SendSacn(const uint8_t* srcip, uint16_t portaddress, uint8_t sequence, uint8_t value, simtime_t now)
+{
+  uint16_t channels = LEDS_PER_UNIVERSE * sizeof(CLed);
+  uint16_t universe = portaddress + 1;
+  SSimPacket* packet = SimNewPacket(sizeof(SE131Data) - sizeof(((SE131Data*)0)->Data) + channels);
+  SE131Data* msg = (SE131Data*)packet->data;
+  memcpy(msg, g_e131id, E131_IDSIZE);
+  msg->RootVector[3] = E131_VECTOR_ROOT_DATA;
+  memcpy(msg->Cid, srcip, 4); //the cid only has to be unique
+  msg->FramingVector[3] = E131_VECTOR_FRAMING_DATA;
+  msg->Priority = 100;
+  msg->Sequence = sequence;
+  msg->UniverseHi = universe >> 8;
+  msg->UniverseLo = universe & 0xFF;
+  msg->DmpVector = E131_VECTOR_DMP_SET_PROPERTY;
+  msg->AddressType = E131_ADDRESS_TYPE;
+  msg->AddressIncrementLo = 1;
+  msg->PropertyCountHi = (channels + 1) >> 8;
+  msg->PropertyCountLo = (channels + 1) & 0xFF;
+  memset(msg->Data, value, channels);
+
+  memcpy(packet->srcip, srcip, sizeof(packet->srcip));
+  packet->dstip[0] = 239;
+  packet->dstip[1] = 255;
+  packet->dstip[2] = universe >> 8;
+  packet->dstip[3] = universe & 0xFF;
+  packet->dstport = SACNPORT;
+  Send(packet, now);
+}
+#endif
+
+//sends the led data of portaddress as ArtDmx to dstip, or as sACN with -e
+static void SendData(const uint8_t* srcip, const uint8_t* dstip, uint16_t portaddress, uint8_t sequence, uint8_t value, simtime_t now)
+{
+#if SACN
+  if (g_sacn)
+  {
+    SendSacn(srcip, portaddress, sequence, value, now);
+    return;
+  }
+#endif
+
+  SendDmx(srcip, dstip, portaddress, sequence, value, now);
+}
+
+static void RunSource(uint32_t index, simtime_t now)
+{
+  static const uint8_t broadcast[4] = { 255, 255, 255, 255 };
+  SSource& source = g_sources[index];
+  uint8_t sequence = source.count % 255 + 1;
+
+  if (source.type == SourceFrames)
+  {
+    for (uint32_t i = 0; i < g_numnodes; i++)
+    {
+      for (uint8_t universe = 0; universe < NUM_UNIVERSES; universe++)
+        SendData(source.ip, g_broadcastframes ? broadcast : g_nodes[i].leaseip, (i * NUM_UNIVERSES + universe) & 0x3FFF,
+                 sequence, source.count, now);
+    }
+
+    if (g_sync)
+      Send(NewArtNet(OpSync, sizeof(SArtSync), source.ip, broadcast), now);
+  }
+  else if (source.type == SourceForeign)
+  {
+    for (uint32_t i = 0; i < g_foreign; i++)
+      SendData(source.ip, broadcast, (g_numnodes * NUM_UNIVERSES + i) & 0x3FFF, sequence, source.count, now);
+  }
+  else if (source.type == SourcePoll)
+  {
+    g_polls.push_back(g_uplinkfree > now ? (simtime_t)g_uplinkfree : now);
+    Send(NewArtNet(OpPoll, sizeof(SArtPoll), source.ip, broadcast), now);
+  }
+  else if (source.type == SourcePcap)
+  {
+    SSimPacket* packet = g_pcap[source.count];
+    Send(packet, now);
+    if (source.count + 1 < g_pcap.size())
+      AddEvent(g_pcap[source.count + 1]->sendtime, EventSource, index);
+    source.count++;
+    return;
+  }
+
+  source.count++;
+  AddEvent(now + source.interval, EventSource, index);
+}
+
+static void AddSource(SourceType type, simtime_t interval, simtime_t start, uint8_t controller)
+{
+  SSource source = {};
+  source.type = type;
+  source.interval = interval;
+  IntToAddress(source.ip, AddressToInt(g_nodemask) | (0xFFFFFE - controller));
+  g_sources.push_back(source);
+  AddEvent(start, EventSource, g_sources.size() - 1);
+}
+
+static uint16_t Read16(const uint8_t* data)
+{
+  return (data[0] << 8) | data[1];
+}
+
+//reads the udp packets to the Art-Net ports from a pcap file, with ethernet or linux cooked capture headers,
+//their times start at start
+static bool LoadPcap(const char* filename, simtime_t start)
+{
+  FILE* file = fopen(filename, "rb");
+  if (!file)
+  {
+    perror(filename);
+    return false;
+  }
+
+  uint8_t header[24];
+  uint32_t magic;
+  if (fread(header, 1, sizeof(header), file) != sizeof(header))
+  {
+    fprintf(stderr, "%s is not a pcap file\n", filename);
+    fclose(file);
+    return false;
+  }
+
+  //the magic tells the byte order and whether the times are in micro or nanoseconds
+  memcpy(&magic, header, sizeof(magic));
+  bool swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+  bool nanoseconds = magic == 0xA1B23C4D || magic == 0x4D3CB2A1;
+  if (!swapped && magic != 0xA1B2C3D4 && !nanoseconds)
+  {
+    fprintf(stderr, "%s is not a pcap file\n", filename);
+    fclose(file);
+    return false;
+  }
+
+  uint32_t linktype;
+  memcpy(&linktype, header + 20, sizeof(linktype));
+  if (swapped)
+    linktype = __builtin_bswap32(linktype);
+  uint16_t linkheader = linktype == 1 ? 14 : linktype == 113 ? 16 : 0;
+  if (linkheader == 0)
+  {
+    fprintf(stderr, "%s has link type %u, only ethernet and linux cooked captures are supported\n", filename, linktype);
+    fclose(file);
+    return false;
+  }
+
+  simtime_t first = 0;
+  uint8_t record[16];
+  static uint8_t frame[65536];
+  while (fread(record, 1, sizeof(record), file) == sizeof(record))
+  {
+    uint32_t fields[4];
+    memcpy(fields, record, sizeof(fields));
+    for (uint8_t i = 0; swapped && i < 4; i++)
+      fields[i] = __builtin_bswap32(fields[i]);
+
+    uint32_t caplen = fields[2];
+    if (caplen > sizeof(frame) || fread(frame, 1, caplen, file) != caplen)
+      break;
+
+    simtime_t time = (simtime_t)fields[0] * 1000000 + (nanoseconds ? fields[1] / 1000 : fields[1]);
+    if (g_pcap.empty())
+      first = time;
+
+    //skip vlan tags, then only take ipv4 udp to the Art-Net ports
+    uint32_t offset = linkheader;
+    uint16_t ethertype = Read16(frame + offset - 2);
+    while (ethertype == 0x8100 && offset + 4 <= caplen)
+    {
+      ethertype = Read16(frame + offset + 2);
+      offset += 4;
+    }
+
+    if (ethertype != 0x0800 || offset + 20 > caplen || frame[offset + 9] != 17)
+      continue;
+
+    uint32_t udp = offset + (frame[offset] & 0x0F) * 4;
+    if (udp + 8 > caplen)
+      continue;
+
+    uint16_t dstport = Read16(frame + udp + 2);
+    uint32_t udplen = Read16(frame + udp + 4);
+    if ((dstport != ARTNETPORT && dstport != ARTNETPORT - 1) || udplen < 8)
+      continue;
+
+    uint16_t len = min(udplen - 8, caplen - udp - 8);
+
+    SSimPacket* packet = SimNewPacket(len);
+    packet->sendtime = start + time - first;
+    memcpy(packet->srcip, frame + offset + 12, sizeof(packet->srcip));
+    memcpy(packet->dstip, frame + offset + 16, sizeof(packet->dstip));
+    packet->dstport = dstport;
+    memcpy(packet->data, frame + udp + 8, len);
+    g_pcap.push_back(packet);
+  }
+
+  fclose(file);
+  fprintf(stderr, "read %u Art-Net packets from %s\n", (unsigned int)g_pcap.size(), filename);
+  return true;
+}
+
+static void Simulate(simtime_t end)
+{
+  while (!g_events.empty() && g_events.top().time <= end)
+  {
+    SEvent event = g_events.top();
+    g_events.pop();
+    g_eventcount++;
+
+    if (event.type == EventRun)
+    {
+      SSimNode* node = g_nodes + event.index;
+      if (event.time != node->nextrun)
+        continue; //the node was woken up earlier
+
+      //loop() runs all the time, but when there's nothing to receive,
+      //running it every millisecond is enough for the timers of the firmware
+      simtime_t done = SimRunNode(node, event.time);
+      node->nextrun = node->rxcount > 0 ? done : done + 1000;
+      AddEvent(node->nextrun, EventRun, event.index);
+    }
+    else if (event.type == EventArrive)
+    {
+      SSimNode* node = g_nodes + event.index;
+      if (SimReceive(node, event.packet))
+        WakeNode(node, event.time);
+      SimReleasePacket(event.packet);
+    }
+    else if (event.type == EventSource)
+    {
+      RunSource(event.index, event.time);
+    }
+  }
+}
+
+static void PrintRow(const char* name, const uint64_t* values, bool total, double scale = 1)
+{
+  uint64_t sum = 0;
+  uint64_t minimum = values[0];
+  uint64_t maximum = values[0];
+  for (uint32_t i = 0; i < g_numnodes; i++)
+  {
+    sum += values[i];
+    minimum = min(minimum, values[i]);
+    maximum = max(maximum, values[i]);
+  }
+
+  if (total)
+    printf("%-30s %12llu", name, (unsigned long long)sum);
+  else
+    printf("%-30s %12s", name, "");
+  printf(" %10.1f %10.1f %10.1f\n", minimum * scale, (double)sum / g_numnodes * scale, maximum * scale);
+}
+
+static void PrintStats()
+{
+  uint64_t* values = new uint64_t[g_numnodes];
+  printf("%-30s %12s %10s %10s %10s\n", "", "total", "min", "avg", "max");
+
+#define ROW(name, expr, total, scale) \
+  for (uint32_t i = 0; i < g_numnodes; i++) { SSimNode* node = g_nodes + i; values[i] = (expr); } \
+  PrintRow(name, values, total, scale);
+
+  ROW("received", node->received, true, 1);
+  ROW("dropped, receive buffer full", node->dropped, true, 1);
+  ROW("dropped by the switch", node->lost, true, 1);
+  ROW("dropped by the filter", node->filtered, true, 1);
+  ROW("dropped by the classifier", node->rejected, true, 1);
+  ROW("frames shown", node->framesshown, true, 1);
+  ROW("frame latency ms", node->latencycount ? node->latencysum / node->latencycount : 0, false, 0.001);
+  ROW("worst frame latency ms", node->latencymax, false, 0.001);
+  ROW("transmitted", node->transmitted, true, 1);
+  ROW("watchdog resets", node->resets, true, 1);
+#undef ROW
+
+  delete[] values;
+
+  if (g_verbose)
+  {
+    printf("\n%-6s %-15s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+           "node", "ip", "received", "dropped", "lost", "filtered", "frames", "latency", "maxlat", "resets");
+    for (uint32_t i = 0; i < g_numnodes; i++)
+    {
+      SSimNode* node = g_nodes + i;
+      char ip[16];
+      snprintf(ip, sizeof(ip), "%u.%u.%u.%u", node->ip[0], node->ip[1], node->ip[2], node->ip[3]);
+      printf("%-6u %-15s %9u %9u %9u %9u %9u %9.1f %9.1f %9u\n", i, ip, node->received, node->dropped, node->lost,
+             node->filtered, node->framesshown,
+             node->latencycount ? (double)node->latencysum / node->latencycount / 1000 : 0,
+             node->latencymax / 1000.0, node->resets);
+    }
+  }
+}
+
+//how the ArtPollReplies of the nodes came in after each ArtPoll, and over the whole run
+static void PrintPollReplies(simtime_t end)
+{
+  if (g_pollreplies.empty())
+    return;
+
+  printf("\n");
+  size_t reply = 0;
+  for (size_t i = 0; i < g_polls.size(); i++)
+  {
+    simtime_t start = g_polls[i];
+    simtime_t next = i + 1 < g_polls.size() ? g_polls[i + 1] : end;
+    while (reply < g_pollreplies.size() && g_pollreplies[reply].time < start)
+      reply++;
+
+    size_t first = reply;
+    while (reply < g_pollreplies.size() && g_pollreplies[reply].time < next)
+      reply++;
+
+    size_t count = reply - first;
+    if (count == 0)
+    {
+      printf("ArtPoll at %.1f ms: no replies\n", start / 1000.0);
+      continue;
+    }
+
+    printf("ArtPoll at %.1f ms: %u replies from %u nodes, first after %.1f ms, half after %.1f ms, last after %.1f ms\n",
+           start / 1000.0, (unsigned int)count, g_numnodes,
+           (g_pollreplies[first].time - start) / 1000.0,
+           (g_pollreplies[first + count / 2].time - start) / 1000.0,
+           (g_pollreplies[reply - 1].time - start) / 1000.0);
+  }
+
+  printf("\nArtPollReplies per %u ms\n", TIMELINEBUCKET / 1000);
+  size_t bucketstart = 0;
+  while (bucketstart < g_pollreplies.size())
+  {
+    simtime_t bucket = g_pollreplies[bucketstart].time / TIMELINEBUCKET;
+    size_t bucketend = bucketstart;
+    while (bucketend < g_pollreplies.size() && g_pollreplies[bucketend].time / TIMELINEBUCKET == bucket)
+      bucketend++;
+
+    printf("%8.0f ms %6u\n", (double)(bucket * TIMELINEBUCKET) / 1000.0, (unsigned int)(bucketend - bucketstart));
+    bucketstart = bucketend;
+  }
+}
+
+static bool CompareReplies(const SPollReply& a, const SPollReply& b)
+{
+  return a.time < b.time;
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  while ((c = getopt(argc, argv, "n:t:w:f:byep:c:x:dr:i:vh")) != -1)
+  {
+    if (c == 'n')
+      g_numnodes = strtoul(optarg, NULL, 0);
+    else if (c == 't')
+      g_seconds = strtod(optarg, NULL);
+    else if (c == 'w')
+      g_warmup = strtoul(optarg, NULL, 0);
+    else if (c == 'f')
+      g_fps = strtoul(optarg, NULL, 0);
+    else if (c == 'b')
+      g_broadcastframes = true;
+    else if (c == 'y')
+      g_sync = true;
+    else if (c == 'e')
+      g_sacn = true;
+    else if (c == 'p')
+      g_pollinterval = strtoul(optarg, NULL, 0);
+    else if (c == 'c')
+      g_numcontrollers = strtoul(optarg, NULL, 0);
+    else if (c == 'x')
+      g_foreign = strtoul(optarg, NULL, 0);
+    else if (c == 'd')
+      g_duplicate = true;
+    else if (c == 'r')
+    {
+      if (sscanf(optarg, "%lf:%lf", &g_renewtime, &g_renewspread) < 1)
+      {
+        fprintf(stderr, "invalid renewal %s\n", optarg);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (c == 'i')
+      g_pcapfile = optarg;
+    else if (c == 'v')
+      g_verbose = true;
+    else
+    {
+      Usage(argv[0]);
+      return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (g_numnodes == 0 || g_numnodes > 0xFFFFFD)
+  {
+    fprintf(stderr, "number of nodes must be from 1 to %u\n", 0xFFFFFD);
+    return EXIT_FAILURE;
+  }
+
+  if (g_sacn && !SACN)
+  {
+    fprintf(stderr, "-e needs a build with SACN enabled\n");
+    return EXIT_FAILURE;
+  }
+
+  simtime_t start = (simtime_t)g_warmup * 1000;
+  simtime_t end = (simtime_t)(g_seconds * 1000000);
+  if (g_pcapfile && !LoadPcap(g_pcapfile, start))
+    return EXIT_FAILURE;
+
+  g_nodes = new SSimNode[g_numnodes];
+  for (uint32_t i = 0; i < g_numnodes; i++)
+  {
+    uint8_t ip[4];
+    IntToAddress(ip, 0x0A000000 | (i + 1));
+    SimInitNode(g_nodes + i, i, ip, g_nodemask);
+    SimBootNode(g_nodes + i, 0);
+    g_nodes[i].nextrun = g_nodes[i].clock;
+    AddEvent(g_nodes[i].nextrun, EventRun, i);
+
+    if (g_renewtime >= 0)
+      g_nodes[i].renewtime = 1 + (simtime_t)((g_renewtime + g_renewspread * i / g_numnodes) * 1000000);
+  }
+
+  if (g_fps > 0)
+    AddSource(SourceFrames, 1000000 / g_fps, start, 0);
+  if (g_fps > 0 && g_foreign > 0)
+    AddSource(SourceForeign, 1000000 / g_fps, start, 0);
+  for (uint32_t i = 0; g_pollinterval > 0 && i < g_numcontrollers; i++)
+    AddSource(SourcePoll, (simtime_t)g_pollinterval * 1000, start + (simtime_t)g_pollinterval * 1000 * i / g_numcontrollers, i);
+  if (!g_pcap.empty())
+  {
+    AddSource(SourcePcap, 0, g_pcap[0]->sendtime, 0);
+  }
+
+  struct timespec wallstart, wallend;
+  clock_gettime(CLOCK_MONOTONIC, &wallstart);
+  Simulate(end);
+  clock_gettime(CLOCK_MONOTONIC, &wallend);
+
+  double walltime = (wallend.tv_sec - wallstart.tv_sec) + (wallend.tv_nsec - wallstart.tv_nsec) / 1e9;
+  printf("simulated %.1f s of %u nodes with %u universes each, %llu packets sent, %llu events in %.1f s\n\n",
+         end / 1e6, g_numnodes, NUM_UNIVERSES, (unsigned long long)g_packetssent, (unsigned long long)g_eventcount, walltime);
+
+  PrintStats();
+  std::stable_sort(g_pollreplies.begin(), g_pollreplies.end(), CompareReplies);
+  PrintPollReplies(end);
+
+  return EXIT_SUCCESS;
+}
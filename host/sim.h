@@ -0,0 +1,110 @@
+#ifndef SIM_H
+#define SIM_H
+
+//the simulated nodes of loc_sim, see sim.cpp,
+//every node runs its own CController on the HAL in hal_sim.cpp, in virtual time
+
+#include "../hal.h"
+
+class CController;
+
+//virtual time in microseconds
+typedef uint64_t simtime_t;
+
+//packets the ENC28J60 counts in EPKTCNT, which is 8 bits
+#define SIMMAXPENDING 255
+
+//multicast groups a node can join
+#define SIMMAXGROUPS 16
+
+//a udp packet on the simulated network, shared by all nodes it's delivered to
+struct SSimPacket
+{
+  uint32_t  refs;
+  simtime_t sendtime; //when the sender put it on the network
+  uint8_t   srcip[4];
+  uint16_t  srcport;
+  uint8_t   dstip[4];
+  uint16_t  dstport;
+  uint16_t  len;
+  uint8_t   data[]; //the udp payload
+};
+
+struct SSimListener
+{
+  uint16_t         port;
+  HalUdpCallback   callback;
+  HalUdpClassifier classifier;
+};
+
+struct SSimNode
+{
+  uint16_t     index;
+  CController* controller;
+  uint8_t*     noinit; //the HALNOINIT variables of this node while another one runs
+
+  uint8_t      ip[4];
+  uint8_t      mask[4];
+  uint8_t      gw[4];
+  uint8_t      dns[4];
+  uint8_t      mac[6];
+  uint8_t      leaseip[4]; //the address DHCP hands out to this node
+  uint8_t      buffer[HALBUFFERSIZE];
+  SSimListener listeners[4];
+  uint8_t      numlisteners;
+  bool         filter;
+  uint16_t     filterport;
+  uint8_t      filterpattern[16];
+  uint16_t     filtermask;
+  bool         broadcast;    //the packet being handled was sent to a broadcast address
+  uint8_t      groups[SIMMAXGROUPS][4]; //the multicast groups the switch forwards to the node
+  uint8_t      numgroups;
+  uint8_t      eeprom[HALEEPROMSIZE];
+
+  simtime_t    clock;        //how far the node has run
+  simtime_t    nextrun;      //when loop() runs next
+  simtime_t    linkfree;     //when the link from the switch to the node is free
+  simtime_t    txfree;       //when the ENC28J60 has finished transmitting
+  simtime_t    watchdogtime;
+  simtime_t    renewtime;    //when DHCP renews the lease, 0 if it isn't pending
+  bool         dhcprenewed;
+
+  //the receive buffer of the ENC28J60
+  SSimPacket*  rx[SIMMAXPENDING];
+  uint16_t     rxhead;
+  uint16_t     rxcount;
+  uint16_t     rxused;       //bytes of the receive buffer in use
+
+  uint32_t     received;     //packets put in the receive buffer
+  uint32_t     dropped;      //packets that didn't fit in the receive buffer
+  uint32_t     lost;         //packets dropped by the switch, because the link to the node was backed up too far
+  uint32_t     filtered;     //broadcasts dropped by the pattern match filter
+  uint32_t     rejected;     //packets dropped by the classifier
+  uint32_t     framesshown;
+  uint32_t     transmitted;
+  uint32_t     resets;
+  simtime_t    datasent;     //send time of the last led data handled since the leds were shown
+  bool         datapending;
+  uint64_t     latencysum;
+  uint32_t     latencycount;
+  simtime_t    latencymax;
+};
+
+void        SimInitNode(SSimNode* node, uint16_t index, const uint8_t* ip, const uint8_t* mask);
+//powers up or resets the node and runs setup()
+void        SimBootNode(SSimNode* node, simtime_t now);
+//runs one iteration of loop() at now, returns when it should run again
+simtime_t   SimRunNode(SSimNode* node, simtime_t now);
+//called when a packet has come in over the link of the node, returns false if it was dropped
+bool        SimReceive(SSimNode* node, SSimPacket* packet);
+//true when the node has joined the multicast group
+bool        SimJoined(SSimNode* node, const uint8_t* group);
+//time a packet of len udp payload bytes takes on the 10 Mbit link
+simtime_t   SimWireTime(uint16_t len);
+
+SSimPacket* SimNewPacket(uint16_t len);
+void        SimReleasePacket(SSimPacket* packet);
+//implemented in sim.cpp, puts a packet sent by a node on the network
+void        SimTransmit(SSimNode* node, SSimPacket* packet);
+
+#endif //SIM_H
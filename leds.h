@@ -0,0 +1,35 @@
+#ifndef LEDS_H
+#define LEDS_H
+
+#include "hal.h"
+
+//how a led is stored in the led buffers
+
+//when PALETTE is enabled, every led is a byte indexing a palette of PALETTESIZE colors,
+//so one universe carries 510 leds in the same RAM as 170 rgb leds,
+//the palette costs PALETTESIZE * 3 bytes of RAM, 192 bytes for the default 64 colors, 256 colors don't fit on the ATmega328P,
+//it's set with ArtNzs (NzsPalette)
+//and expanded to rgb by HalLedsShowPalette() while the leds are sent,
+//gamma, brightness and channel order are applied when the palette is set
+#ifndef PALETTE
+#define PALETTE 0
+#endif
+
+#ifndef PALETTESIZE
+#define PALETTESIZE 64
+#endif
+
+#if PALETTESIZE > 256 || (PALETTESIZE & (PALETTESIZE - 1)) != 0
+#error PALETTESIZE must be a power of two, at most 256
+#endif
+
+#if PALETTE
+typedef uint8_t CLed; //index into the palette
+#define LEDS_PER_UNIVERSE 510
+#else
+typedef CRGB CLed;
+//one universe carries 510 channels, which is 170 leds
+#define LEDS_PER_UNIVERSE 170
+#endif
+
+#endif //LEDS_H
@@ -1,32 +1,42 @@
-#include <avr/wdt.h>
+#ifdef __AVR__
+//included here so the Arduino IDE adds these libraries to the build
 #include <EtherCard.h>
-#include <IPAddress.h>
+#include <FastSPI_LED2.h>
+#endif
+#include "hal.h"
 #include "controller.h"
 #include "debugprint.h"
 
+void SetupDebug();
+void UdpArtNet(uint16_t port, uint8_t ip[4], const char* data, uint16_t len);
+uint16_t UdpArtNetClassify(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len);
+
 CController g_controller;
 
 void setup()
 {
-  SetupWatchdog();
+  HalWatchdogSetup();
   SetupDebug();
   DBGPRINT("board started\n");
 
   g_controller.Initialize();
-  ether.udpServerListenOnPort(&UdpArtNet, ARTNETPORT);
+  HalNetListen(ARTNETPORT, &UdpArtNet, &UdpArtNetClassify);
   //when data is received on one port lower than the art-net port
   //the artpollreply is sent as unicast, this is to prevent filling up the buffers
   //of all art-net controllers on the network
-  ether.udpServerListenOnPort(&UdpArtNet, ARTNETPORT - 1);
+  HalNetListen(ARTNETPORT - 1, &UdpArtNet, &UdpArtNetClassify);
+#if SACN
+  HalNetListen(SACNPORT, &UdpArtNet, &UdpArtNetClassify);
+#endif
 }
 
 void loop()
 {
-  ether.packetLoop(ether.packetReceive());
+  g_controller.Poll();
   g_controller.Process();
 }
 
-#if DEBUG
+#if DEBUG && defined(__AVR__)
 static FILE uartout = {0};
 static int uart_putchar (char c, FILE *stream)
 {
@@ -35,20 +45,9 @@ static int uart_putchar (char c, FILE *stream)
 }
 #endif
 
-void SetupWatchdog()
-{
-  //the WDTON fuse should be programmed to 0 in the high fuse byte,
-  //to make the watchdog timer permanently enabled
-  //here the watchdog timer is set to the comfortable timeout of 8 seconds
-  cli();
-  wdt_reset();
-  wdt_enable(WDTO_8S);
-  sei();
-}
-
 void SetupDebug()
 {
-#if DEBUG
+#if DEBUG && defined(__AVR__)
   //set up the serial port, and redirect stdout to it, this will allow using printf
   Serial.begin(57600);
   fdev_setup_stream(&uartout, uart_putchar, NULL, _FDEV_SETUP_WRITE);
@@ -56,7 +55,12 @@ void SetupDebug()
 #endif
 }
 
-void UdpArtNet(word port, byte ip[4], const char* data, word len)
+uint16_t UdpArtNetClassify(uint16_t port, const uint8_t* data, uint16_t peeklen, uint16_t len)
+{
+  return g_controller.ClassifyPacket(port, data, peeklen, len);
+}
+
+void UdpArtNet(uint16_t port, uint8_t ip[4], const char* data, uint16_t len)
 {
 #if DEBUG
   DBGPRINT("--------------------------------------------\n");
@@ -86,9 +90,3 @@ void UdpArtNet(word port, byte ip[4], const char* data, word len)
 
   g_controller.HandlePacket(ip, port, (uint8_t*)data, len);
 }
-
-void Transmit(uint8_t* data, uint16_t size, uint16_t sourceport, const uint8_t* destip, uint16_t destport)
-{
-  ether.sendUdp((char*)data, size, sourceport, (uint8_t*)destip, destport);
-}
-
@@ -0,0 +1,243 @@
+#include "hal.h"
+#include "sacn.h"
+#include "controller.h"
+#include "debugprint.h"
+
+#if SACN
+
+const uint8_t g_e131id[E131_IDSIZE] PROGMEM =
+{
+  0x00, 0x10, 0x00, 0x00, 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0x00, 0x00, 0x00
+};
+
+static uint32_t Vector(const uint8_t* vector)
+{
+  return ((uint32_t)vector[0] << 24) | ((uint32_t)vector[1] << 16) | ((uint32_t)vector[2] << 8) | vector[3];
+}
+
+CSacn::CSacn(CController& controller, uint8_t* ip) :
+  m_controller(controller), m_ip(ip)
+{
+  m_portaddress = 0;
+  memset(m_sources, 0, sizeof(m_sources));
+  m_merging = false;
+  m_sendreport = false;
+  m_sendreporttime = 0;
+}
+
+void CSacn::Initialize(uint16_t portaddress)
+{
+  //the port address might have changed, leave the groups of the old universes
+  m_portaddress = portaddress;
+  m_sendreport = false;
+  HalNetLeaveMulticast();
+  ReportGroups();
+}
+
+void CSacn::Process(uint32_t now)
+{
+  //switches with IGMP snooping stop forwarding the groups nobody reports after a query
+  if (HalNetMulticastQueried())
+  {
+    HalNetClearMulticastQueried();
+    if (!m_sendreport)
+    {
+      uint16_t host = ((uint16_t)m_ip[2] << 8) | m_ip[3];
+      m_sendreport = true;
+      m_sendreporttime = now + ((uint32_t)host * 8) % IGMPREPORTWINDOW;
+      DBGPRINT("Scheduled IGMP report in %lu ms\n", m_sendreporttime - now);
+    }
+  }
+
+  if (m_sendreport && (int32_t)(now - m_sendreporttime) >= 0)
+  {
+    m_sendreport = false;
+    ReportGroups();
+  }
+}
+
+//joins the group of every universe, which reports it to the switches again
+void CSacn::ReportGroups()
+{
+  for (uint8_t i = 0; i < NUM_UNIVERSES; i++)
+  {
+    uint16_t universe = m_portaddress + 1 + i;
+    uint8_t group[4] = { 239, 255, (uint8_t)(universe >> 8), (uint8_t)(universe & 0xFF) };
+    HalNetJoinMulticast(group);
+  }
+}
+
+uint16_t CSacn::ClassifyPacket(const uint8_t* data, uint16_t peeklen, uint16_t len)
+{
+  if (peeklen < E131_IDSIZE || memcmp_P(data, g_e131id, E131_IDSIZE) != 0)
+    return 0;
+
+  //the universe comes after the peeked bytes, packets for other universes the multicast filter lets through
+  //are dropped by HandlePacket, only the channels that map to leds are read
+  return min(len, sizeof(SE131Data) - sizeof(((SE131Data*)data)->Data) + LEDS_PER_UNIVERSE * sizeof(CLed));
+}
+
+void CSacn::HandlePacket(uint8_t* data, uint16_t len)
+{
+  SE131Data* msg = (SE131Data*)data;
+  uint16_t headersize = sizeof(SE131Data) - sizeof(msg->Data);
+  if (len < headersize || memcmp_P(data, g_e131id, E131_IDSIZE) != 0)
+  {
+    DBGPRINT("Received invalid sACN packet with size %u\n", len);
+    return;
+  }
+
+  //E1.31 synchronization and universe discovery packets have another vector, they're not handled
+  if (Vector(msg->RootVector) != E131_VECTOR_ROOT_DATA || Vector(msg->FramingVector) != E131_VECTOR_FRAMING_DATA ||
+      msg->DmpVector != E131_VECTOR_DMP_SET_PROPERTY || msg->AddressType != E131_ADDRESS_TYPE)
+  {
+    DBGPRINT("Received sACN packet with vector %lu\n", Vector(msg->RootVector));
+    return;
+  }
+
+  uint16_t sacnuniverse = ((uint16_t)msg->UniverseHi << 8) | msg->UniverseLo;
+  uint16_t universe = sacnuniverse - 1 - m_portaddress;
+  if (universe >= NUM_UNIVERSES)
+  {
+    DBGPRINT("Received sACN data for another universe %u, my universes are %u to %u\n",
+             sacnuniverse, m_portaddress + 1, m_portaddress + NUM_UNIVERSES);
+    return;
+  }
+
+  //preview data is meant for visualisers
+  if (msg->Options & E131Preview)
+    return;
+
+  if (msg->Options & E131Terminated)
+  {
+    DropSource(msg->Cid);
+    return;
+  }
+
+  //alternate start codes, like per channel priority, are not handled
+  if (msg->StartCode != 0)
+    return;
+
+  int8_t source = FindSource(msg->Cid, msg->Priority, millis());
+  if (source < 0)
+    return;
+
+  //data is valid
+  m_controller.OnValidData();
+
+  //discard packets that arrive after a newer one, or twice
+  if (!CheckSequence(m_sources[source], universe, msg->Sequence))
+    return;
+
+  //the property count includes the start code, it can't be more than the channels that were received
+  uint16_t maxlength = min(512, len - headersize);
+  uint16_t length = ((uint16_t)msg->PropertyCountHi << 8) | msg->PropertyCountLo;
+  length = length > 0 ? min(length - 1, maxlength) : 0;
+  DBGPRINT("Received %u sACN channels for my universe %u from source %i\n", length, sacnuniverse, source);
+
+  m_controller.OnDmxData(source, universe, msg->Data, length);
+}
+
+int8_t CSacn::FindSource(const uint8_t* cid, uint8_t priority, uint32_t now)
+{
+  int8_t  source = -1;
+  int8_t  freesource = -1;
+  int8_t  lowest = -1;      //the other active source with the lowest priority
+  uint8_t highest = 0;      //the highest priority of the other active sources
+  bool    othersactive = false;
+  for (int8_t i = 0; i < NUM_SOURCES; i++)
+  {
+    SSacnSource& sacnsource = m_sources[i];
+
+    //drop sources that stopped sending
+    if (sacnsource.active && now - sacnsource.time >= SACNTIMEOUT)
+    {
+      DBGPRINT("sACN source %i timed out\n", i);
+      sacnsource.active = false;
+    }
+
+    if (sacnsource.active && memcmp(sacnsource.cid, cid, sizeof(sacnsource.cid)) == 0)
+    {
+      source = i;
+    }
+    else if (!sacnsource.active)
+    {
+      if (freesource < 0)
+        freesource = i;
+    }
+    else
+    {
+      if (!othersactive || sacnsource.priority > highest)
+        highest = sacnsource.priority;
+      if (lowest < 0 || sacnsource.priority < m_sources[lowest].priority)
+        lowest = i;
+      othersactive = true;
+    }
+  }
+
+  if (source < 0)
+  {
+    //a new source with a lower priority than the ones sending is ignored,
+    //at the same priority it is merged if merging is enabled, otherwise the first source keeps the universes
+    if (othersactive && (priority < highest || (priority == highest && !MERGE)))
+      return -1;
+
+    //it takes a free slot, or replaces the source with the lowest priority, if that's lower than its own
+    if (freesource >= 0)
+      source = freesource;
+    else if (priority > m_sources[lowest].priority)
+      source = lowest;
+    else
+      return -1;
+
+    memcpy(m_sources[source].cid, cid, sizeof(m_sources[source].cid));
+    m_sources[source].sequencevalid = 0;
+    m_sources[source].active = true;
+  }
+  m_sources[source].priority = priority;
+  m_sources[source].time = now;
+
+  bool merging = MERGE && m_sources[0].active && m_sources[1].active && m_sources[0].priority == m_sources[1].priority;
+  if (merging != m_merging)
+  {
+    DBGPRINT("%S merging sACN\n", merging ? PSTR("Started") : PSTR("Stopped"));
+    m_merging = merging;
+  }
+
+  //only the sources with the highest priority are shown
+  if (othersactive && priority < highest)
+    return -1;
+
+  return source;
+}
+
+void CSacn::DropSource(const uint8_t* cid)
+{
+  for (int8_t i = 0; i < NUM_SOURCES; i++)
+  {
+    if (m_sources[i].active && memcmp(m_sources[i].cid, cid, sizeof(m_sources[i].cid)) == 0)
+    {
+      DBGPRINT("sACN source %i terminated\n", i);
+      m_sources[i].active = false;
+      m_merging = false;
+    }
+  }
+}
+
+bool CSacn::CheckSequence(SSacnSource& source, uint8_t universe, uint8_t sequence)
+{
+  uint16_t bit = 1 << universe;
+  uint8_t  last = source.sequence[universe];
+  int8_t   delta = (int8_t)(uint8_t)(sequence - last);
+  if ((source.sequencevalid & bit) && delta <= 0 && delta > -SACNSEQUENCEWINDOW)
+  {
+    DBGPRINT("Discarding late sACN data with sequence %u, last sequence is %u\n", sequence, last);
+    return false;
+  }
+
+  source.sequence[universe] = sequence;
+  source.sequencevalid |= bit;
+  return true;
+}
+
+#endif //SACN
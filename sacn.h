@@ -0,0 +1,117 @@
+#ifndef SACN_H
+#define SACN_H
+
+#include "hal.h"
+#include "artnet.h"
+
+#define SACNPORT 5568
+
+//when SACN is enabled in hal.h, sACN (ANSI E1.31) data is received beside Art-Net,
+//sACN universe n is port address n - 1, so the node outputs the sACN universes from its port address plus one,
+//the node joins the multicast group of each of its universes, and the network controller
+//only lets those groups through, so switches with IGMP snooping keep the other universes off its link,
+//the receive buffer is 81 bytes bigger for the longer header
+
+//a source that hasn't sent data for this many milliseconds is dropped, E1.31 network data loss
+#define SACNTIMEOUT 2500
+
+//a sequence number at most this much behind the last one is a late packet and is discarded,
+//if it is further behind the source is assumed to have restarted
+#define SACNSEQUENCEWINDOW 20
+
+//the membership of the groups is reported again after an IGMP query,
+//at a time within this many milliseconds based on the ip address,
+//so the nodes don't all answer at once, it is shorter than the 10 seconds a query allows
+#define IGMPREPORTWINDOW 2000
+
+#define E131_VECTOR_ROOT_DATA        0x04
+#define E131_VECTOR_FRAMING_DATA     0x02
+#define E131_VECTOR_DMP_SET_PROPERTY 0x02
+#define E131_ADDRESS_TYPE            0xA1
+
+enum E131Options
+{
+  E131Preview    = 0x80, //the data is for visualisers, not for the leds
+  E131Terminated = 0x40, //the source stopped sending this universe
+};
+
+//an E1.31 data packet, the root, framing and dmp layers
+struct SE131Data
+{
+  uint8_t     PreambleSizeHi;
+  uint8_t     PreambleSizeLo;
+  uint8_t     PostambleSizeHi;
+  uint8_t     PostambleSizeLo;
+  uint8_t     AcnId[12];
+  uint8_t     RootFlagsLengthHi;
+  uint8_t     RootFlagsLengthLo;
+  uint8_t     RootVector[4];
+  uint8_t     Cid[16];
+  uint8_t     FramingFlagsLengthHi;
+  uint8_t     FramingFlagsLengthLo;
+  uint8_t     FramingVector[4];
+  uint8_t     SourceName[64];
+  uint8_t     Priority;
+  uint8_t     SyncAddressHi;
+  uint8_t     SyncAddressLo;
+  uint8_t     Sequence;
+  uint8_t     Options;
+  uint8_t     UniverseHi;
+  uint8_t     UniverseLo;
+  uint8_t     DmpFlagsLengthHi;
+  uint8_t     DmpFlagsLengthLo;
+  uint8_t     DmpVector;
+  uint8_t     AddressType;
+  uint8_t     FirstAddressHi;
+  uint8_t     FirstAddressLo;
+  uint8_t     AddressIncrementHi;
+  uint8_t     AddressIncrementLo;
+  uint8_t     PropertyCountHi; //the start code and the dmx channels
+  uint8_t     PropertyCountLo;
+  uint8_t     StartCode;
+  uint8_t     Data[1]; //the dmx channels, there can be none
+} __attribute__((packed));
+
+//the preamble, postamble and ACN packet identifier every E1.31 packet starts with
+#define E131_IDSIZE 16
+extern const uint8_t g_e131id[E131_IDSIZE] PROGMEM;
+
+//a component sending sACN to this node, two of them at the same priority can be merged
+struct SSacnSource
+{
+  uint8_t  cid[16];
+  uint8_t  priority;
+  uint32_t time;
+  bool     active;
+  uint16_t sequencevalid;            //bitmask of the universes a sequence number was received for
+  uint8_t  sequence[NUM_UNIVERSES];  //last sequence number per universe
+};
+
+class CController;
+
+class CSacn
+{
+  public:
+    CSacn(CController& controller, uint8_t* ip);
+    void     Initialize(uint16_t portaddress);
+    void     Process(uint32_t now);
+    void     HandlePacket(uint8_t* data, uint16_t len);
+    uint16_t ClassifyPacket(const uint8_t* data, uint16_t peeklen, uint16_t len);
+    bool     IsMerging() { return m_merging; }
+
+  private:
+    void   ReportGroups();
+    int8_t FindSource(const uint8_t* cid, uint8_t priority, uint32_t now);
+    void   DropSource(const uint8_t* cid);
+    bool   CheckSequence(SSacnSource& source, uint8_t universe, uint8_t sequence);
+
+    CController& m_controller;
+    uint8_t*     m_ip;
+    uint16_t     m_portaddress;
+    SSacnSource  m_sources[NUM_SOURCES];
+    bool         m_merging;
+    bool         m_sendreport;     //an IGMP query asked for the groups
+    uint32_t     m_sendreporttime;
+};
+
+#endif //SACN_H
@@ -0,0 +1,24 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "hal.h"
+
+//settings kept in the end of the EEPROM, after the cue table,
+//so the node can come up on the network straight away after a reset
+#define SETTINGSADDRESS (HALEEPROMSIZE - 64)
+
+//an EEPROM that was never written reads as 0xFF, the settings are only used when the magic matches
+#define SETTINGSMAGIC 0x4C45 //"LE"
+
+struct SSettings
+{
+  uint8_t MagicHi;
+  uint8_t MagicLo;
+  uint8_t Ip[4]; //the last DHCP lease
+  uint8_t Mask[4];
+  uint8_t Gateway[4];
+  uint8_t PortAddressHi;
+  uint8_t PortAddressLo;
+} __attribute__((packed));
+
+#endif //SETTINGS_H
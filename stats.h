@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "hal.h"
+
+//minimum, average and maximum of a duration in microseconds
+class CTimeStats
+{
+  public:
+    CTimeStats() { Reset(); }
+
+    void Reset()
+    {
+      m_min = 0xFFFF;
+      m_max = 0;
+      m_total = 0;
+      m_count = 0;
+    }
+
+    void Add(uint32_t duration)
+    {
+      uint16_t us = duration < 0xFFFF ? duration : 0xFFFF;
+      if (us < m_min)
+        m_min = us;
+      if (us > m_max)
+        m_max = us;
+
+      //halve the total and the count before they overflow, this keeps the average the same
+      if (m_count == 0xFFFF || m_total > 0xFFFF0000)
+      {
+        m_total /= 2;
+        m_count /= 2;
+      }
+      m_total += us;
+      m_count++;
+    }
+
+    uint16_t Min() const { return m_count ? m_min : 0; }
+    uint16_t Avg() const { return m_count ? m_total / m_count : 0; }
+    uint16_t Max() const { return m_max; }
+
+  private:
+    uint16_t m_min;
+    uint16_t m_max;
+    uint32_t m_total;
+    uint16_t m_count;
+};
+
+#endif //STATS_H